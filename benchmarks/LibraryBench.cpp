@@ -0,0 +1,104 @@
+#include "BeatDescription.h"
+#include "BeatLibrary.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * Measures listing a library of beats: loading every beat, as was needed
+ * before the library index, against scanning the metadata without and with an
+ * index, and querying the result.
+ *
+ * Usage: batteur_library_bench [beats directory]
+ *
+ * The library is made of copies of the beats directory in the temporary
+ * directory. The results go to the standard output as CSV:
+ *
+ *     operation,beats,us
+ *
+ * where us is the best of a few runs.
+ */
+
+using namespace batteur;
+
+namespace {
+
+constexpr int runs { 5 };
+constexpr int copies { 20 };
+
+template <class F>
+double bestOf(F&& function)
+{
+    double best { 0.0 };
+    for (int run = 0; run < runs; ++run) {
+        const auto start = std::chrono::steady_clock::now();
+        function();
+        const auto end = std::chrono::steady_clock::now();
+        const double us = std::chrono::duration<double, std::micro>(end - start).count();
+        if (run == 0 || us < best)
+            best = us;
+    }
+    return best;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    const fs::path beatsDirectory { argc > 1 ? argv[1] : BATTEUR_BENCH_BEATS_DIR };
+    const auto directory = fs::temp_directory_path() / "batteur_bench_library";
+    const auto index = fs::temp_directory_path() / "batteur_bench_library.index";
+    fs::remove_all(directory);
+    fs::remove(index);
+    fs::create_directories(directory);
+    for (int i = 0; i < copies; ++i)
+        fs::copy(beatsDirectory, directory / std::to_string(i), fs::copy_options::recursive);
+
+    std::vector<fs::path> files;
+    for (const auto& entry : fs::recursive_directory_iterator(directory)) {
+        if (entry.path().extension() == ".json")
+            files.push_back(entry.path());
+    }
+
+    std::error_code ec;
+    std::size_t numBeats { 0 };
+    std::printf("operation,beats,us\n");
+
+    const double load = bestOf([&]() {
+        numBeats = 0;
+        for (const auto& file : files)
+            numBeats += BeatDescription::buildFromFile(file, ec) ? 1 : 0;
+    });
+    std::printf("load,%zu,%.1f\n", numBeats, load);
+
+    const double scan = bestOf([&]() {
+        numBeats = BeatLibrary::scan(directory, {}, ec)->beats().size();
+    });
+    std::printf("scan,%zu,%.1f\n", numBeats, scan);
+
+    BeatLibrary::scan(directory, index, ec);
+    std::unique_ptr<BeatLibrary> library;
+    const double indexed = bestOf([&]() {
+        library = BeatLibrary::scan(directory, index, ec);
+    });
+    std::printf("indexed scan,%zu,%.1f\n", library->beats().size(), indexed);
+
+    BeatQuery byGroup;
+    byGroup.group = library->beats().front().group;
+    BeatQuery byTempo;
+    byTempo.minBpm = 90.0f;
+    byTempo.maxBpm = 120.0f;
+    BeatQuery bySignature;
+    bySignature.signature = TimeSignature { 4, 4 };
+    for (const auto& query : { std::make_pair("group query", byGroup), std::make_pair("bpm query", byTempo),
+             std::make_pair("signature query", bySignature) }) {
+        std::size_t found { 0 };
+        const double us = bestOf([&]() { found = library->find(query.second).size(); });
+        std::printf("%s,%zu,%.2f\n", query.first, found, us);
+    }
+
+    fs::remove_all(directory);
+    fs::remove(index);
+    return 0;
+}
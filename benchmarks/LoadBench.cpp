@@ -0,0 +1,181 @@
+#include "BeatDescription.h"
+#include "JsonBeatReader.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <string>
+#include <vector>
+
+/**
+ * Compares the JSON loaders: the document one, which parses the whole text to
+ * a nlohmann::json before reading it, and the streaming one.
+ *
+ * Usage: batteur_load_bench [beats directory]
+ *
+ * Each JSON beat, and a few large synthetic ones, is loaded from its text in
+ * memory. The results go to the standard output as CSV:
+ *
+ *     beat,loader,bytes,us_per_load,peak_bytes
+ *
+ * where us_per_load is the best of a few runs, and peak_bytes is the largest
+ * amount of heap memory in use during a load, beyond what was in use before.
+ */
+
+namespace {
+
+std::atomic<std::size_t> currentBytes { 0 };
+std::atomic<std::size_t> peakBytes { 0 };
+
+// Sizes are kept in front of the blocks, with enough room to keep the alignment
+constexpr std::size_t headerSize { alignof(std::max_align_t) };
+
+void* allocate(std::size_t size)
+{
+    auto block = static_cast<char*>(std::malloc(size + headerSize));
+    if (!block)
+        throw std::bad_alloc();
+
+    *reinterpret_cast<std::size_t*>(block) = size;
+    const auto current = currentBytes.fetch_add(size) + size;
+    auto peak = peakBytes.load();
+    while (current > peak && !peakBytes.compare_exchange_weak(peak, current)) { }
+    return block + headerSize;
+}
+
+void deallocate(void* pointer) noexcept
+{
+    if (!pointer)
+        return;
+
+    auto block = static_cast<char*>(pointer) - headerSize;
+    currentBytes.fetch_sub(*reinterpret_cast<std::size_t*>(block));
+    std::free(block);
+}
+
+}
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void operator delete(void* pointer) noexcept { deallocate(pointer); }
+void operator delete[](void* pointer) noexcept { deallocate(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { deallocate(pointer); }
+void operator delete[](void* pointer, std::size_t) noexcept { deallocate(pointer); }
+
+using namespace batteur;
+
+namespace {
+
+constexpr int runs { 20 };
+
+enum class Loader { Document, Streaming };
+
+const char* loaderName(Loader loader)
+{
+    switch (loader) {
+    case Loader::Document: return "dom";
+    case Loader::Streaming: return "sax";
+    }
+    return "";
+}
+
+struct Result {
+    double usPerLoad;
+    std::size_t peakBytes;
+    bool loaded;
+};
+
+std::unique_ptr<BeatDescription> load(Loader loader, const fs::path& file, const std::string& text)
+{
+    std::error_code error;
+    switch (loader) {
+    case Loader::Document:
+        return buildDescriptionFromJson(file, nlohmann::json::parse(text), error);
+    case Loader::Streaming:
+        return readBeatDescription(text.data(), text.data() + text.size(), file, error);
+    }
+    return {};
+}
+
+Result measure(Loader loader, const fs::path& file, const std::string& text)
+{
+    Result result { 0.0, 0, false };
+    for (int run = 0; run < runs; ++run) {
+        const auto before = currentBytes.load();
+        peakBytes = before;
+        const auto start = std::chrono::steady_clock::now();
+        auto beat = load(loader, file, text);
+        const auto end = std::chrono::steady_clock::now();
+        result.loaded = static_cast<bool>(beat);
+        beat.reset();
+
+        const double us = std::chrono::duration<double, std::micro>(end - start).count();
+        if (run == 0 || us < result.usPerLoad)
+            result.usPerLoad = us;
+        result.peakBytes = std::max(result.peakBytes, peakBytes.load() - before);
+    }
+    return result;
+}
+
+// A beat with `notes` notes in its single part, written as the JSON files are
+std::string largeBeat(int notes)
+{
+    std::string text { "{\n    \"name\": \"Large\",\n    \"bpm\": 120,\n    \"parts\": [\n"
+                       "        {\n            \"name\": \"Large\",\n            \"sequence\": {\n"
+                       "                \"notes\": [\n" };
+    char line[160];
+    for (int i = 0; i < notes; ++i) {
+        std::snprintf(line, sizeof(line),
+            "                    { \"time\": %.4f, \"duration\": 0.1, \"number\": %d, \"velocity\": 0.75 }%s\n",
+            i * 0.25, 35 + (i * 7) % 60, i + 1 < notes ? "," : "");
+        text += line;
+    }
+    text += "                ]\n            }\n        }\n    ]\n}\n";
+    return text;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    const fs::path beatsDirectory { argc > 1 ? argv[1] : BATTEUR_BENCH_BEATS_DIR };
+
+    std::vector<fs::path> files;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(beatsDirectory, ec)) {
+        if (entry.path().extension() == ".json")
+            files.push_back(entry.path());
+    }
+    std::sort(files.begin(), files.end());
+
+    std::vector<std::pair<std::string, std::string>> beats;
+    for (const auto& file : files) {
+        std::ifstream stream { file.string(), std::ios::binary };
+        beats.emplace_back(file.stem().string(),
+            std::string { std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>() });
+    }
+
+    for (int notes : { 10000, 100000 })
+        beats.emplace_back("synthetic/" + std::to_string(notes), largeBeat(notes));
+
+    std::printf("beat,loader,bytes,us_per_load,peak_bytes\n");
+    for (const auto& beat : beats) {
+        const auto file = beatsDirectory / (beat.first + ".json");
+        for (auto loader : { Loader::Document, Loader::Streaming }) {
+            const auto result = measure(loader, file, beat.second);
+            if (!result.loaded) {
+                std::fprintf(stderr, "Could not load %s\n", beat.first.c_str());
+                continue;
+            }
+            std::printf("\"%s\",%s,%zu,%.1f,%zu\n", beat.first.c_str(), loaderName(loader),
+                beat.second.size(), result.usPerLoad, result.peakBytes);
+            std::fflush(stdout);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "FileReadingHelpers.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * Measures the decoding of long MIDI files by readSequence.
+ *
+ * Usage: batteur_midi_bench
+ *
+ * Synthetic single track files are written to the temporary directory, with
+ * 480 ticks per quarter and a hit every 16th note, cycling through the drum
+ * notes 35 to 81:
+ *
+ *  - "short": each hit ends before the next one;
+ *  - "stray-offs": each hit is also followed by a note-off for a note that
+ *    was only struck at the start of the file, as some recorded performances
+ *    have repeated note-offs.
+ *
+ * The results go to the standard output as CSV:
+ *
+ *     file,notes,ms_per_read
+ *
+ * where ms_per_read is the best of a few runs.
+ */
+
+namespace {
+
+constexpr int runs { 5 };
+constexpr unsigned ticksPerStep { 120 };
+
+void writeVariableLength(std::vector<uint8_t>& bytes, uint32_t value)
+{
+    uint8_t buffer[4];
+    int size = 0;
+    do {
+        buffer[size++] = value & 0x7f;
+        value >>= 7;
+    } while (value > 0);
+
+    while (size > 1)
+        bytes.push_back(buffer[--size] | 0x80);
+    bytes.push_back(buffer[0]);
+}
+
+void writeBigEndian(std::vector<uint8_t>& bytes, uint32_t value, int size)
+{
+    for (int i = size - 1; i >= 0; --i)
+        bytes.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+fs::path writeMidiFile(const std::string& name, int notes, bool strayOffs)
+{
+    std::vector<uint8_t> track;
+    const auto event = [&track](uint32_t delta, uint8_t status, uint8_t data1, uint8_t data2) {
+        writeVariableLength(track, delta);
+        track.push_back(status);
+        track.push_back(data1);
+        track.push_back(data2);
+    };
+
+    constexpr uint8_t crash { 85 }; // Outside of the cycled notes
+    if (strayOffs) {
+        event(0, 0x90, crash, 100);
+        event(ticksPerStep / 2, 0x80, crash, 0);
+    }
+
+    for (int i = 0; i < notes; ++i) {
+        const auto number = static_cast<uint8_t>(35 + (i * 5) % 47);
+        event(i == 0 && !strayOffs ? 0 : ticksPerStep / 2, 0x90, number, 100);
+        event(ticksPerStep / 4, 0x80, number, 0);
+        if (strayOffs)
+            event(0, 0x80, crash, 0);
+        else
+            event(0, 0xa0, number, 0); // Aftertouch, so that both files have as many events
+    }
+    writeVariableLength(track, ticksPerStep / 4);
+    track.insert(track.end(), { 0xff, 0x2f, 0x00 });
+
+    std::vector<uint8_t> bytes { 'M', 'T', 'h', 'd' };
+    writeBigEndian(bytes, 6, 4);
+    writeBigEndian(bytes, 0, 2); // Format
+    writeBigEndian(bytes, 1, 2); // Tracks
+    writeBigEndian(bytes, 480, 2); // Ticks per quarter
+    bytes.insert(bytes.end(), { 'M', 'T', 'r', 'k' });
+    writeBigEndian(bytes, static_cast<uint32_t>(track.size()), 4);
+    bytes.insert(bytes.end(), track.begin(), track.end());
+
+    const auto path = fs::temp_directory_path() / name;
+    std::ofstream stream { path.string(), std::ios::binary | std::ios::trunc };
+    stream.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    return path;
+}
+
+}
+
+int main()
+{
+    std::printf("file,notes,ms_per_read\n");
+    for (bool strayOffs : { false, true }) {
+        for (int notes : { 10000, 100000 }) {
+            const std::string name { std::string(strayOffs ? "stray-offs" : "short") + "-" + std::to_string(notes) };
+            double best { 0.0 };
+            std::size_t read { 0 };
+            for (int run = 0; run < runs; ++run) {
+                // A new file for each run, so that decoded files are not reused
+                const auto file = writeMidiFile("batteur_bench_" + name + "_" + std::to_string(run) + ".mid", notes, strayOffs);
+                const nlohmann::json json { { "filename", file.filename().string() } };
+                const auto start = std::chrono::steady_clock::now();
+                const auto sequence = readSequence(json, file.parent_path());
+                const auto end = std::chrono::steady_clock::now();
+                fs::remove(file);
+
+                read = sequence ? sequence->size() : 0;
+                const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+                if (run == 0 || ms < best)
+                    best = ms;
+            }
+            std::printf("%s,%zu,%.2f\n", name.c_str(), read, best);
+            std::fflush(stdout);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include "BeatDescription.h"
+#include "Player.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Measures Player::tick in nanoseconds per block.
+ *
+ * Usage: batteur_bench [beats directory]
+ *
+ * Each beat is rendered for a fixed amount of audio at every block size, once
+ * while playing the first part and once while cycling through fills, part
+ * changes, endings and restarts. The results go to the standard output as CSV:
+ *
+ *     beat,scenario,block_size,blocks,ns_per_block,events
+ *
+ * where ns_per_block is the best of a few runs.
+ */
+
+using namespace batteur;
+
+namespace {
+
+constexpr int sampleRate { 48000 };
+constexpr int renderedSeconds { 60 };
+constexpr int runs { 5 };
+constexpr int maxEvents { 1024 };
+constexpr std::array<int, 10> blockSizes { { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192 } };
+
+enum class Scenario { Play, Transitions };
+
+const char* scenarioName(Scenario scenario)
+{
+    switch (scenario) {
+    case Scenario::Play: return "play";
+    case Scenario::Transitions: return "transitions";
+    }
+    return "";
+}
+
+struct Result {
+    long blocks;
+    double nsPerBlock;
+    long events;
+};
+
+Result render(const BeatDescription& beat, Scenario scenario, int blockSize)
+{
+    // Commands of the transition scenario, one every 3 seconds of audio
+    using Command = bool (Player::*)(int);
+    constexpr std::array<Command, 5> commands { {
+        &Player::fillIn, &Player::next, &Player::fillIn, &Player::stop, &Player::start
+    } };
+    constexpr long commandPeriod { 3 * sampleRate };
+
+    const long blocks { static_cast<long>(renderedSeconds) * sampleRate / blockSize };
+    Result result { blocks, 0.0, 0 };
+    std::array<NoteEvent, maxEvents> events;
+
+    for (int run = 0; run < runs; ++run) {
+        Player player;
+        player.setSampleRate(sampleRate);
+        player.loadBeatDescription(beat);
+        player.start();
+
+        long time { 0 };
+        long nextCommand { commandPeriod };
+        std::size_t commandIndex { 0 };
+        long numEvents { 0 };
+
+        const auto start = std::chrono::steady_clock::now();
+        for (long block = 0; block < blocks; ++block) {
+            if (scenario == Scenario::Transitions) {
+                while (nextCommand < time + blockSize) {
+                    (player.*commands[commandIndex])(static_cast<int>(nextCommand - time));
+                    commandIndex = (commandIndex + 1) % commands.size();
+                    nextCommand += commandPeriod;
+                }
+            }
+            numEvents += player.tick(blockSize, events.data(), maxEvents);
+            time += blockSize;
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        const double ns = std::chrono::duration<double, std::nano>(end - start).count() / blocks;
+        if (run == 0 || ns < result.nsPerBlock)
+            result.nsPerBlock = ns;
+        result.events = numEvents;
+    }
+
+    return result;
+}
+
+// A one bar groove with `voices` notes on each step of `stepsPerQuarter`,
+// cycling through note numbers so that they are not merged. A closed hi-hat
+// on each step of `hatStepsPerQuarter` is added on top, doubling some of the
+// voices so that the note merging has work to do.
+std::unique_ptr<BeatDescription> denseBeat(const std::string& name, int stepsPerQuarter, int voices,
+    int hatStepsPerQuarter = 0)
+{
+    std::unique_ptr<BeatDescription> beat { new BeatDescription };
+    beat->name = name;
+    beat->bpm = 180;
+    beat->quartersPerBar = 4;
+    beat->signature = { 4, 4 };
+
+    Part part;
+    part.name = "Dense";
+    Sequence& sequence = part.mainLoop;
+    const int steps = 4 * stepsPerQuarter;
+    for (int step = 0; step < steps; ++step) {
+        const double time = static_cast<double>(step) / stepsPerQuarter;
+        for (int voice = 0; voice < voices; ++voice) {
+            const auto number = static_cast<uint8_t>(35 + (step * 7 + voice * 5) % 60);
+            sequence.emplace_back(time + 0.001 * voice, 0.05, number, 0.7f);
+        }
+    }
+    for (int step = 0; step < 4 * hatStepsPerQuarter; ++step)
+        sequence.emplace_back(static_cast<double>(step) / hatStepsPerQuarter, 0.05, 42, 0.5f);
+    std::sort(sequence.begin(), sequence.end(), [](const Note& lhs, const Note& rhs) {
+        return lhs.timestamp < rhs.timestamp;
+    });
+
+    // Fills and an ending so that the transition scenario has work to do
+    part.fills.push_back(sequence);
+    beat->ending = sequence;
+    beat->parts.push_back(part);
+    beat->parts.push_back(part);
+    std::error_code error;
+    if (!beat->compile(error))
+        return {};
+
+    return beat;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    const fs::path beatsDirectory { argc > 1 ? argv[1] : BATTEUR_BENCH_BEATS_DIR };
+
+    std::vector<std::pair<std::string, std::unique_ptr<BeatDescription>>> beats;
+    std::vector<fs::path> files;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(beatsDirectory, ec)) {
+        if (entry.path().extension() == ".json")
+            files.push_back(entry.path());
+    }
+    std::sort(files.begin(), files.end());
+
+    for (const auto& file : files) {
+        std::error_code error;
+        auto beat = BeatDescription::buildFromFile(file, error);
+        if (!beat) {
+            std::fprintf(stderr, "Could not load %s: %s\n", file.string().c_str(), error.message().c_str());
+            continue;
+        }
+        beats.emplace_back(file.stem().string(), std::move(beat));
+    }
+
+    beats.emplace_back("synthetic/16th-4", denseBeat("16th-4", 4, 4));
+    beats.emplace_back("synthetic/64th-12", denseBeat("64th-12", 16, 12));
+    beats.emplace_back("synthetic/32nd-12-hat", denseBeat("32nd-12-hat", 8, 12, 2));
+
+    std::printf("beat,scenario,block_size,blocks,ns_per_block,events\n");
+    for (const auto& beat : beats) {
+        for (auto scenario : { Scenario::Play, Scenario::Transitions }) {
+            for (int blockSize : blockSizes) {
+                const auto result = render(*beat.second, scenario, blockSize);
+                std::printf("\"%s\",%s,%d,%ld,%.1f,%ld\n", beat.first.c_str(),
+                    scenarioName(scenario), blockSize, result.blocks, result.nsPerBlock, result.events);
+                std::fflush(stdout);
+            }
+        }
+    }
+
+    return 0;
+}
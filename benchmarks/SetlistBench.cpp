@@ -0,0 +1,101 @@
+#include "BeatDescription.h"
+#include "Player.h"
+#include "Setlist.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * Measures a setlist made of every beat of the beats directory: building it,
+ * and switching songs while playing, against loading each new beat from its
+ * file as was needed before setlists.
+ *
+ * Usage: batteur_setlist_bench [beats directory]
+ *
+ * The results go to the standard output as CSV:
+ *
+ *     operation,songs,us
+ *
+ * where us is the best of a few runs, per song for the switches.
+ */
+
+using namespace batteur;
+
+namespace {
+
+constexpr int runs { 5 };
+constexpr int blockSize { 256 };
+
+template <class F>
+double bestOf(F&& function)
+{
+    double best { 0.0 };
+    for (int run = 0; run < runs; ++run) {
+        const auto start = std::chrono::steady_clock::now();
+        function();
+        const auto end = std::chrono::steady_clock::now();
+        const double us = std::chrono::duration<double, std::micro>(end - start).count();
+        if (run == 0 || us < best)
+            best = us;
+    }
+    return best;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    const fs::path beatsDirectory { argc > 1 ? argv[1] : BATTEUR_BENCH_BEATS_DIR };
+    std::vector<fs::path> files;
+    for (const auto& entry : fs::directory_iterator(beatsDirectory)) {
+        if (entry.path().extension() == ".json")
+            files.push_back(entry.path());
+    }
+    std::sort(files.begin(), files.end());
+
+    std::string text { "{ \"songs\": [" };
+    for (std::size_t i = 0; i < files.size(); ++i)
+        text += (i > 0 ? ", { \"beat\": \"" : " { \"beat\": \"") + files[i].filename().string() + "\" }";
+    text += " ] }";
+
+    std::error_code ec;
+    std::unique_ptr<Setlist> setlist;
+    std::printf("operation,songs,us\n");
+    const double build = bestOf([&]() { setlist = Setlist::buildFromString(beatsDirectory / "setlist.json", text, ec); });
+    if (!setlist)
+        return 1;
+
+    const auto numSongs = setlist->songs().size();
+    std::printf("build,%zu,%.1f\n", numSongs, build);
+
+    Player player;
+    player.setSampleRate(48000);
+    player.setNoteCallback([](int, uint8_t, float) {});
+    player.loadBeatDescription(setlist->songs().front().beat);
+    player.start();
+    player.tick(blockSize);
+
+    const double fromArena = bestOf([&]() {
+        for (const auto& song : setlist->songs()) {
+            player.queueBeatDescription(song.beat);
+            player.tick(blockSize);
+        }
+    });
+    std::printf("switch from arena,%zu,%.3f\n", numSongs, fromArena / numSongs);
+
+    std::vector<std::unique_ptr<BeatDescription>> loaded;
+    const double fromFile = bestOf([&]() {
+        loaded.clear();
+        for (const auto& file : files) {
+            loaded.push_back(BeatDescription::buildFromFile(file, ec));
+            player.queueBeatDescription(*loaded.back());
+            player.tick(blockSize);
+        }
+        player.loadBeatDescription(setlist->songs().front().beat);
+        player.tick(blockSize);
+    });
+    std::printf("switch from file,%zu,%.3f\n", files.size(), fromFile / files.size());
+    return 0;
+}
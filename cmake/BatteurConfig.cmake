@@ -75,6 +75,7 @@ Build as shared library:       ${BATTEUR_SHARED}
 Build JACK stand-alone client: ${BATTEUR_JACK}
 Build LV2 plug-in:             ${BATTEUR_LV2}
 Build tests:                   ${BATTEUR_TESTS}
+Build benchmarks:              ${BATTEUR_BENCHMARKS}
 Use libc++:                    ${BATTEUR_TESTS}
 Link libatomic:                ${USE_LIBCPP}
 
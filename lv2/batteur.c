@@ -43,7 +43,9 @@
 
 #include <math.h>
 #include "batteur.h"
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -52,17 +54,74 @@
 #define batteur__beatDescription "https://github.com/paulfd/batteur:beatDescription"
 #define batteur__beatName "https://github.com/paulfd/batteur:beatName"
 #define batteur__partName "https://github.com/paulfd/batteur:partName"
+#define batteur__setlist "https://github.com/paulfd/batteur:setlist"
+#define batteur__songName "https://github.com/paulfd/batteur:songName"
+#define batteur__freeSetlist "https://github.com/paulfd/batteur:freeSetlist"
+#define batteur__releaseBeat "https://github.com/paulfd/batteur:releaseBeat"
+#define batteur__copyBeat "https://github.com/paulfd/batteur:copyBeat"
+#define batteur__beatData "https://github.com/paulfd/batteur:beatData"
 #define CHANNEL_MASK 0x0F
 #define NOTE_ON 0x90
 #define NOTE_OFF 0x80
+#define CONTROL_CHANGE 0xB0
 #define MIDI_CHANNEL(byte) (byte & CHANNEL_MASK)
 #define MIDI_STATUS(byte) (byte & ~CHANNEL_MASK)
 #define MAX_BLOCK_SIZE 8192
 #define MAX_PATH_SIZE 1024
+#define MAX_EVENTS 1024
 #define UNUSED(x) (void)(x)
 #define SWITCH_DURATION 0.75
 #define DEFAULT_ACCENT_NOTE 49
 #define DEFAULT_ACCENT_VELOCITY 0.787
+#define MAX_MIDI_ACCENTS 64
+#define MAX_SAVE_ATTEMPTS 8
+
+// Player actions that MIDI notes or control changes can trigger
+enum {
+    MIDI_START = 0,
+    MIDI_FILL,
+    MIDI_NEXT,
+    MIDI_STOP,
+    MIDI_ACCENT,
+    NUM_MIDI_ACTIONS
+};
+
+typedef struct
+{
+    int frame;
+    float velocity;
+} midi_accent_t;
+
+// Worker message: a path to load, what was loaded from it, something to free,
+// or a beat of the setlist to copy
+typedef struct
+{
+    LV2_Atom atom; // The type tells which of these it is
+    union {
+        batteur_beat_t* beat;
+        batteur_setlist_t* setlist;
+    } object;
+    uint32_t copy_generation; // Of the copy of a beat of the setlist
+    char path[MAX_PATH_SIZE + 1];
+} worker_message_t;
+
+#define WORKER_MESSAGE_HEADER_SIZE offsetof(worker_message_t, path)
+
+// What a restore without a worker leaves for run() to load, with the state
+// of the slot that it is passed in
+typedef struct
+{
+    batteur_beat_t* embedded; // Beat saved in the state, if any
+    char beat_path[MAX_PATH_SIZE + 1]; // Empty if none
+    char setlist_path[MAX_PATH_SIZE + 1];
+} restore_request_t;
+
+enum {
+    RESTORE_FREE = 0,
+    RESTORE_WRITING,
+    RESTORE_READY,
+    RESTORE_READING
+};
 
 typedef struct
 {
@@ -89,6 +148,13 @@ typedef struct
     float* fill_total_p;
     const float* tempo_p;
     const float* tempo_sync_p;
+    const float* song_p;
+    float* song_index_p;
+    float* song_total_p;
+    const float* embed_p;
+    const float* midi_type_p;
+    const float* midi_channel_p;
+    const float* midi_action_p[NUM_MIDI_ACTIONS];
 
     // Atom forge
     LV2_Atom_Forge forge; ///< Forge for writing atoms in run thread
@@ -110,6 +176,7 @@ typedef struct
     LV2_URID atom_string_uri;
     LV2_URID atom_bool_uri;
     LV2_URID atom_path_uri;
+    LV2_URID atom_chunk_uri;
     LV2_URID patch_set_uri;
     LV2_URID patch_get_uri;
     LV2_URID patch_put_uri;
@@ -123,20 +190,35 @@ typedef struct
     LV2_URID beat_description_uri;
     LV2_URID beat_name_uri;
     LV2_URID part_name_uri;
+    LV2_URID setlist_uri;
+    LV2_URID song_name_uri;
+    LV2_URID free_setlist_uri;
+    LV2_URID release_beat_uri;
+    LV2_URID copy_beat_uri;
+    LV2_URID beat_data_uri;
 
     // Sfizz related data
     // sfizz_synth_t *synth;
     batteur_beat_t* currentBeat;
-    batteur_beat_t* nextBeat;
+    batteur_beat_t* nextBeat; // Queued in the player, if any
+    batteur_beat_t* shown_beat; // Last beat whose names were sent
+    batteur_beat_t* song_copy; // Cached copy of song_copy_of, for save()
+    batteur_beat_t* song_copy_of; // Beat of the setlist playing or queued, if any
+    uint32_t song_copy_generation; // Of the last copy requested
+    batteur_setlist_t* setlist;
+    batteur_setlist_t* old_setlist; // Freed by the worker once the player is done with it
+    int song_request;
     batteur_player_t* player;
     bool expect_nominal_block_length;
     float main_switch_status;
     bool accent_pressed;
     char beat_file_path[MAX_PATH_SIZE + 1];
+    char setlist_file_path[MAX_PATH_SIZE + 1];
     char* bundle_path;
     int max_block_size;
     int accent_note;
     bool sync_to_host_tempo;
+    bool embed_beat; // Save the beat itself in the state, besides its path
     bool transport_played;
     float knob_bpm;
     float host_bpm;
@@ -145,6 +227,13 @@ typedef struct
     int64_t last_main_up;
     int64_t last_main_down;
     double sample_rate;
+    batteur_event_t events[MAX_EVENTS];
+    restore_request_t restore_request;
+    atomic_int restore_state;
+    _Atomic(batteur_beat_t*) saved_beat; // Published by run() for save(), NULL to not embed it
+    bool midi_cc_down[NUM_MIDI_ACTIONS];
+    midi_accent_t midi_accents[MAX_MIDI_ACCENTS]; // Sent along with the notes of the block
+    int num_midi_accents;
 } batteur_plugin_t;
 
 enum {
@@ -163,6 +252,17 @@ enum {
     FILL_TOTAL_PORT,
     TEMPO_PORT,
     TEMPO_SYNC_PORT,
+    SONG_PORT,
+    SONG_INDEX_PORT,
+    SONG_TOTAL_PORT,
+    EMBED_PORT,
+    MIDI_TYPE_PORT,
+    MIDI_CHANNEL_PORT,
+    START_MIDI_PORT,
+    FILL_MIDI_PORT,
+    NEXT_MIDI_PORT,
+    STOP_MIDI_PORT,
+    ACCENT_MIDI_PORT,
 };
 
 static void
@@ -176,6 +276,7 @@ batteur_map_required_uris(batteur_plugin_t* self)
     self->atom_float_uri = map->map(map->handle, LV2_ATOM__Float);
     self->atom_int_uri = map->map(map->handle, LV2_ATOM__Int);
     self->atom_path_uri = map->map(map->handle, LV2_ATOM__Path);
+    self->atom_chunk_uri = map->map(map->handle, LV2_ATOM__Chunk);
     self->atom_bool_uri = map->map(map->handle, LV2_ATOM__Bool);
     self->atom_string_uri = map->map(map->handle, LV2_ATOM__String);
     self->atom_urid_uri = map->map(map->handle, LV2_ATOM__URID);
@@ -193,6 +294,12 @@ batteur_map_required_uris(batteur_plugin_t* self)
     self->beat_description_uri = map->map(map->handle, batteur__beatDescription);
     self->beat_name_uri = map->map(map->handle, batteur__beatName);
     self->part_name_uri = map->map(map->handle, batteur__partName);
+    self->setlist_uri = map->map(map->handle, batteur__setlist);
+    self->song_name_uri = map->map(map->handle, batteur__songName);
+    self->free_setlist_uri = map->map(map->handle, batteur__freeSetlist);
+    self->release_beat_uri = map->map(map->handle, batteur__releaseBeat);
+    self->copy_beat_uri = map->map(map->handle, batteur__copyBeat);
+    self->beat_data_uri = map->map(map->handle, batteur__beatData);
 }
 
 static void
@@ -248,6 +355,31 @@ connect_port(LV2_Handle instance,
     case TEMPO_SYNC_PORT:
         self->tempo_sync_p = (const float*)data;
         break;
+    case SONG_PORT:
+        self->song_p = (const float*)data;
+        break;
+    case SONG_INDEX_PORT:
+        self->song_index_p = (float*)data;
+        break;
+    case SONG_TOTAL_PORT:
+        self->song_total_p = (float*)data;
+        break;
+    case EMBED_PORT:
+        self->embed_p = (const float*)data;
+        break;
+    case MIDI_TYPE_PORT:
+        self->midi_type_p = (const float*)data;
+        break;
+    case MIDI_CHANNEL_PORT:
+        self->midi_channel_p = (const float*)data;
+        break;
+    case START_MIDI_PORT:
+    case FILL_MIDI_PORT:
+    case NEXT_MIDI_PORT:
+    case STOP_MIDI_PORT:
+    case ACCENT_MIDI_PORT:
+        self->midi_action_p[port - START_MIDI_PORT] = (const float*)data;
+        break;
     default:
         break;
     }
@@ -310,6 +442,11 @@ instantiate(const LV2_Descriptor* descriptor,
     self->expect_nominal_block_length = false;
     self->beat_file_path[0] = '\0';
     self->beat_file_path[MAX_PATH_SIZE] = '\0';
+    self->setlist_file_path[0] = '\0';
+    self->setlist_file_path[MAX_PATH_SIZE] = '\0';
+    self->song_request = 0;
+    atomic_init(&self->restore_state, RESTORE_FREE);
+    atomic_init(&self->saved_beat, NULL);
     self->accent_pressed = false;
     self->last_main_up = 0;
     self->beat = 0.0f;
@@ -409,7 +546,6 @@ instantiate(const LV2_Descriptor* descriptor,
     }
 
     self->player = batteur_new();
-    batteur_note_cb(self->player, &batteur_callback, (void*)self);
     return (LV2_Handle)self;
 
 abort:
@@ -422,9 +558,14 @@ static void
 cleanup(LV2_Handle instance)
 {
     batteur_plugin_t* self = (batteur_plugin_t*)instance;
-    batteur_free_beat(self->currentBeat);
-    batteur_free_beat(self->nextBeat);
+    if (atomic_load(&self->restore_state) == RESTORE_READY)
+        batteur_release_beat(self->restore_request.embedded);
+    batteur_release_beat(self->currentBeat);
+    batteur_release_beat(self->nextBeat);
+    batteur_release_beat(self->song_copy);
     batteur_free(self->player);
+    batteur_setlist_free(self->setlist);
+    batteur_setlist_free(self->old_setlist);
     free(self->bundle_path);
     free(self);
 }
@@ -464,7 +605,7 @@ send_beat_name(batteur_plugin_t* self)
     lv2_atom_forge_urid(&self->forge, self->beat_name_uri);
     lv2_atom_forge_key(&self->forge, self->patch_value_uri);
 
-    const char* name = batteur_get_beat_name(self->currentBeat);
+    const char* name = batteur_get_beat_name(batteur_get_current_beat(self->player));
     if (name)
         lv2_atom_forge_string(&self->forge, name, strlen(name));
     else
@@ -484,7 +625,7 @@ send_part_name(batteur_plugin_t* self)
     lv2_atom_forge_key(&self->forge, self->patch_value_uri);
 
     int part_index = batteur_get_part_index(self->player);
-    const char* name = batteur_get_part_name(self->currentBeat, part_index);
+    const char* name = batteur_get_part_name(batteur_get_current_beat(self->player), part_index);
     if (name)
         lv2_atom_forge_string(&self->forge, name, strlen(name));
     else
@@ -493,6 +634,236 @@ send_part_name(batteur_plugin_t* self)
     lv2_atom_forge_pop(&self->forge, &frame);
 }
 
+static void 
+send_setlist_path(batteur_plugin_t* self)
+{
+    LV2_Atom_Forge_Frame frame;
+    lv2_atom_forge_frame_time(&self->forge, 0);
+    lv2_atom_forge_object(&self->forge, &frame, 0, self->patch_set_uri);
+    lv2_atom_forge_key(&self->forge, self->patch_property_uri);
+    lv2_atom_forge_urid(&self->forge, self->setlist_uri);
+    lv2_atom_forge_key(&self->forge, self->patch_value_uri);
+    lv2_atom_forge_path(&self->forge, self->setlist_file_path, strlen(self->setlist_file_path));
+    lv2_atom_forge_pop(&self->forge, &frame);
+}
+
+static void 
+send_song_name(batteur_plugin_t* self)
+{
+    LV2_Atom_Forge_Frame frame;
+    lv2_atom_forge_frame_time(&self->forge, 0);
+    lv2_atom_forge_object(&self->forge, &frame, 0, self->patch_set_uri);
+    lv2_atom_forge_key(&self->forge, self->patch_property_uri);
+    lv2_atom_forge_urid(&self->forge, self->song_name_uri);
+    lv2_atom_forge_key(&self->forge, self->patch_value_uri);
+
+    int song_index = batteur_setlist_find_song(self->setlist, batteur_get_current_beat(self->player));
+    const char* name = batteur_setlist_get_song_name(self->setlist, song_index);
+    if (name)
+        lv2_atom_forge_string(&self->forge, name, strlen(name));
+    else
+        lv2_atom_forge_string(&self->forge, "", 0);
+
+    lv2_atom_forge_pop(&self->forge, &frame);
+}
+
+static void
+schedule_free(batteur_plugin_t* self, LV2_URID type, worker_message_t* message)
+{
+    message->atom.type = type;
+    message->atom.size = WORKER_MESSAGE_HEADER_SIZE - sizeof(LV2_Atom);
+    self->worker->schedule_work(self->worker->handle, WORKER_MESSAGE_HEADER_SIZE, message);
+}
+
+// Hand a beat back to the worker, which releases it
+static void
+release_beat(batteur_plugin_t* self, batteur_beat_t* beat)
+{
+    if (!beat)
+        return;
+
+    worker_message_t message;
+    message.object.beat = beat;
+    schedule_free(self, self->release_beat_uri, &message);
+}
+
+// Ask the worker for a cached copy of a beat of the setlist. The setlist is
+// only freed by a later message, so the beat is still there for the worker.
+static void
+schedule_song_copy(batteur_plugin_t* self, batteur_beat_t* beat)
+{
+    worker_message_t message;
+    message.atom.type = self->copy_beat_uri;
+    message.atom.size = WORKER_MESSAGE_HEADER_SIZE - sizeof(LV2_Atom);
+    message.object.beat = beat;
+    message.copy_generation = ++self->song_copy_generation;
+    self->worker->schedule_work(self->worker->handle, WORKER_MESSAGE_HEADER_SIZE, &message);
+}
+
+/**
+ * Publish the beat that save() embeds: the one queued in the player if any,
+ * or else the one it plays. This is done before the beats it replaces are
+ * released, so that save() can tell whether the beat it retained is still the
+ * published one.
+ *
+ * The beats of a setlist are not in the cache and go away with the setlist,
+ * so save() gets a cached copy of the song instead, made by the worker. No
+ * beat is embedded until the copy is back.
+ */
+static void
+publish_saved_beat(batteur_plugin_t* self)
+{
+    batteur_beat_t* beat = batteur_get_queued_beat(self->player);
+    if (!beat)
+        beat = batteur_get_current_beat(self->player);
+    if (!self->embed_beat)
+        beat = NULL;
+
+    const bool song = beat && beat != self->currentBeat && beat != self->nextBeat;
+    batteur_beat_t* replaced = NULL;
+    if (!song || beat != self->song_copy_of) {
+        replaced = self->song_copy;
+        self->song_copy = NULL;
+        self->song_copy_of = song ? beat : NULL;
+        if (song)
+            schedule_song_copy(self, beat);
+    }
+
+    atomic_store(&self->saved_beat, song ? self->song_copy : beat);
+    release_beat(self, replaced);
+}
+
+// Keep the copy of a song made by the worker, unless another song took over
+static void
+install_song_copy(batteur_plugin_t* self, batteur_beat_t* copy, uint32_t generation)
+{
+    if (generation != self->song_copy_generation || !self->song_copy_of || self->song_copy) {
+        release_beat(self, copy);
+        return;
+    }
+
+    self->song_copy = copy;
+    publish_saved_beat(self);
+}
+
+static void
+free_setlist(batteur_plugin_t* self, batteur_setlist_t* setlist)
+{
+    worker_message_t message;
+    message.object.setlist = setlist;
+    schedule_free(self, self->free_setlist_uri, &message);
+}
+
+/**
+ * Ask a worker to load a beat or a setlist. This is used both from run(),
+ * and from restore() with the worker the host gives it. A beat already
+ * loaded from the state is passed through the worker to the audio thread.
+ */
+static void
+schedule_load(batteur_plugin_t* self, LV2_Worker_Schedule* worker, LV2_URID type,
+    const char* path, uint32_t size, batteur_beat_t* beat)
+{
+    if (size > MAX_PATH_SIZE) {
+        lv2_log_error(&self->logger, "File path size too big (%d), ignoring.\n", size);
+        batteur_release_beat(beat);
+        return;
+    }
+
+    worker_message_t message;
+    message.atom.type = type;
+    message.atom.size = (uint32_t)(WORKER_MESSAGE_HEADER_SIZE - sizeof(LV2_Atom) + size + 1);
+    message.object.beat = beat;
+    memcpy(message.path, path, size);
+    message.path[size] = '\0';
+    if (worker->schedule_work(worker->handle, lv2_atom_total_size(&message.atom), &message) != LV2_WORKER_SUCCESS)
+        batteur_release_beat(beat);
+}
+
+static void
+play_song(batteur_plugin_t* self, int song_index)
+{
+    // The song tempo is followed, unless the host tempo is
+    const batteur_tempo_change_t tempo_change = 
+        self->sync_to_host_tempo ? BATTEUR_TEMPO_KEEP : BATTEUR_TEMPO_GLIDE;
+    const bool playing = batteur_playing(self->player);
+    if (!batteur_setlist_play_song(self->setlist, song_index, self->player,
+            BATTEUR_SWITCH_NEXT_BAR, tempo_change))
+        return;
+
+    // A beat queued from a file was replaced
+    batteur_beat_t* replaced = self->nextBeat;
+    self->nextBeat = NULL;
+    publish_saved_beat(self);
+    release_beat(self, replaced);
+    if (!playing && self->sync_to_host_tempo)
+        batteur_set_tempo(self->player, self->host_bpm);
+}
+
+static bool
+setlist_in_use(batteur_plugin_t* self, batteur_setlist_t* setlist)
+{
+    return batteur_setlist_find_song(setlist, batteur_get_current_beat(self->player)) >= 0
+        || batteur_setlist_find_song(setlist, batteur_get_queued_beat(self->player)) >= 0;
+}
+
+/**
+ * Make a loaded setlist the current one, and switch to the selected song.
+ * The previous setlist is kept until the player is done with it, and a new
+ * setlist cannot be installed until then.
+ */
+static bool
+install_setlist(batteur_plugin_t* self, batteur_setlist_t* setlist, const char* path)
+{
+    if (self->old_setlist)
+        return false;
+
+    self->old_setlist = self->setlist;
+    self->setlist = setlist;
+    strncpy(self->setlist_file_path, path, MAX_PATH_SIZE);
+    self->setlist_file_path[MAX_PATH_SIZE] = '\0';
+    play_song(self, self->song_request);
+    return true;
+}
+
+/**
+ * Switch to a beat loaded by the worker: it is queued if the player is
+ * playing, and loaded otherwise. The beats the player no longer uses are
+ * handed back to the worker.
+ */
+static void
+install_beat(batteur_plugin_t* self, batteur_beat_t* beat, const char* path)
+{
+    if (batteur_playing(self->player)) {
+        // Keep playing; run() swaps the beats once the new one takes over
+        if (!batteur_queue(self->player, beat, BATTEUR_SWITCH_NEXT_BAR, BATTEUR_TEMPO_KEEP)) {
+            release_beat(self, beat);
+            return;
+        }
+        batteur_beat_t* replaced = self->nextBeat;
+        self->nextBeat = beat;
+        publish_saved_beat(self);
+        release_beat(self, replaced);
+    } else {
+        if (!batteur_load(self->player, beat)) {
+            release_beat(self, beat);
+            return;
+        }
+        // Loading also dropped the queued beat
+        batteur_beat_t* replaced_current = self->currentBeat;
+        batteur_beat_t* replaced_next = self->nextBeat;
+        self->currentBeat = beat;
+        self->nextBeat = NULL;
+        publish_saved_beat(self);
+        release_beat(self, replaced_current);
+        release_beat(self, replaced_next);
+        batteur_set_tempo(self->player, 
+            self->sync_to_host_tempo ? self->host_bpm : self->knob_bpm);
+    }
+
+    strncpy(self->beat_file_path, path, MAX_PATH_SIZE);
+    self->beat_file_path[MAX_PATH_SIZE] = '\0';
+}
+
 static void
 main_switch_event(batteur_plugin_t* self, float switch_status)
 {
@@ -529,12 +900,78 @@ main_switch_event(batteur_plugin_t* self, float switch_status)
     }
 }
 
+/**
+ * Apply a mapped action at the frame of its MIDI event. The player splits
+ * its next tick at that frame, so the response does not depend on the
+ * block size.
+ */
+static void
+midi_action(batteur_plugin_t* self, int action, int frame, float velocity)
+{
+    switch (action) {
+    case MIDI_START:
+        batteur_start_at(self->player, frame);
+        break;
+    case MIDI_FILL:
+        batteur_fill_in_at(self->player, frame);
+        break;
+    case MIDI_NEXT:
+        batteur_next_at(self->player, frame);
+        break;
+    case MIDI_STOP:
+        batteur_stop_at(self->player, frame);
+        break;
+    case MIDI_ACCENT:
+        if (self->num_midi_accents < MAX_MIDI_ACCENTS) {
+            midi_accent_t* accent = &self->midi_accents[self->num_midi_accents++];
+            accent->frame = frame;
+            accent->velocity = velocity;
+        }
+        break;
+    }
+}
+
+static void
+midi_event(batteur_plugin_t* self, const LV2_Atom* atom, int frame)
+{
+    if (atom->size < 3)
+        return;
+
+    const uint8_t* msg = (const uint8_t*)LV2_ATOM_BODY_CONST(atom);
+    const int channel = (int)*self->midi_channel_p;
+    if (channel > 0 && MIDI_CHANNEL(msg[0]) != channel - 1)
+        return;
+
+    // Notes trigger on note on, and control changes when they go from below
+    // 64 to 64 or above, like a sustain pedal
+    const bool use_cc = *self->midi_type_p > 0.0f;
+    for (int action = 0; action < NUM_MIDI_ACTIONS; ++action) {
+        if ((int)*self->midi_action_p[action] != msg[1])
+            continue;
+
+        if (use_cc && MIDI_STATUS(msg[0]) == CONTROL_CHANGE) {
+            const bool down = msg[2] >= 64;
+            if (down && !self->midi_cc_down[action])
+                midi_action(self, action, frame, DEFAULT_ACCENT_VELOCITY);
+            self->midi_cc_down[action] = down;
+        } else if (!use_cc && MIDI_STATUS(msg[0]) == NOTE_ON && msg[2] > 0) {
+            midi_action(self, action, frame, msg[2] / 127.0f);
+        }
+    }
+}
+
 static void
 beat_description_event(batteur_plugin_t* self, const LV2_Atom* atom)
 {
     // If the parameter is different from the current one we send it through
     if (strncmp(self->beat_file_path, LV2_ATOM_BODY_CONST(atom), strlen(self->beat_file_path)))
-        self->worker->schedule_work(self->worker->handle, lv2_atom_total_size(atom), atom);
+        schedule_load(self, self->worker, self->beat_description_uri, LV2_ATOM_BODY_CONST(atom), atom->size, NULL);
+}
+
+static void
+setlist_event(batteur_plugin_t* self, const LV2_Atom* atom)
+{
+    schedule_load(self, self->worker, self->setlist_uri, LV2_ATOM_BODY_CONST(atom), atom->size, NULL);
 }
 
 static void
@@ -567,6 +1004,8 @@ handle_patch_set(batteur_plugin_t* self, const LV2_Atom_Object* obj, int64_t fra
 
     if (key == self->beat_description_uri) {
         beat_description_event(self, atom);
+    } else if (key == self->setlist_uri) {
+        setlist_event(self, atom);
     } else {
         lv2_log_warning(&self->logger, "[handle_object] Unknown or unsupported object.\n");
         if (self->unmap)
@@ -588,12 +1027,18 @@ handle_patch_get(batteur_plugin_t* self, const LV2_Atom_Object* obj, int64_t fra
         send_file_path(self);
         send_beat_name(self);
         send_part_name(self);
+        send_setlist_path(self);
+        send_song_name(self);
     } else if (property->body == self->beat_description_uri) {
         send_file_path(self);
     } else if (property->body == self->beat_name_uri) {
         send_beat_name(self);
     } else if (property->body == self->part_name_uri) {
         send_part_name(self);
+    } else if (property->body == self->setlist_uri) {
+        send_setlist_path(self);
+    } else if (property->body == self->song_name_uri) {
+        send_song_name(self);
     }
 }
 
@@ -664,7 +1109,7 @@ run(LV2_Handle instance, uint32_t sample_count)
             }
             // Got an atom that is a MIDI event
         } else if (ev->body.type == self->midi_event_uri) {
-            // Nothing to do here
+            midi_event(self, &ev->body, (int)ev->time.frames);
         }
     }
 
@@ -680,6 +1125,25 @@ run(LV2_Handle instance, uint32_t sample_count)
             batteur_set_tempo(self->player, self->knob_bpm);
     }
 
+    if ((int)*self->song_p - 1 != self->song_request) {
+        self->song_request = (int)*self->song_p - 1;
+        play_song(self, self->song_request);
+    }
+
+    self->embed_beat = (bool)(*self->embed_p);
+
+    int restore_ready = RESTORE_READY;
+    if (atomic_compare_exchange_strong(&self->restore_state, &restore_ready, RESTORE_READING)) {
+        const restore_request_t* request = &self->restore_request;
+        if (request->embedded || request->beat_path[0])
+            schedule_load(self, self->worker, self->beat_description_uri,
+                request->beat_path, (uint32_t)strlen(request->beat_path), request->embedded);
+        if (request->setlist_path[0])
+            schedule_load(self, self->worker, self->setlist_uri,
+                request->setlist_path, (uint32_t)strlen(request->setlist_path), NULL);
+        atomic_store(&self->restore_state, RESTORE_FREE);
+    }
+
     if (*self->main_p != self->main_switch_status) {
         main_switch_event(self, *self->main_p);
         self->main_switch_status = *self->main_p;
@@ -697,14 +1161,58 @@ run(LV2_Handle instance, uint32_t sample_count)
 
     self->last_main_up += sample_count;
     self->last_main_down += sample_count;
-    batteur_tick(self->player, sample_count);
+    // The accents from MIDI are merged with the notes, which come in order
+    const int num_events = batteur_tick_into(self->player, sample_count, self->events, MAX_EVENTS);
+    const uint8_t accent_note = (uint8_t)*self->accent_note_p;
+    int accent_index = 0;
+    for (int i = 0; i < num_events; ++i) {
+        const batteur_event_t* event = &self->events[i];
+        for (; accent_index < self->num_midi_accents && self->midi_accents[accent_index].frame <= event->delay; ++accent_index) {
+            const midi_accent_t* accent = &self->midi_accents[accent_index];
+            batteur_callback(accent->frame, accent_note, accent->velocity, self);
+        }
+        batteur_callback(event->delay, event->number, event->velocity, self);
+    }
+    for (; accent_index < self->num_midi_accents; ++accent_index) {
+        const midi_accent_t* accent = &self->midi_accents[accent_index];
+        batteur_callback(accent->frame, accent_note, accent->velocity, self);
+    }
+    self->num_midi_accents = 0;
+
+    // The queued beat took over, and the previous one is no longer used
+    if (self->nextBeat && batteur_get_current_beat(self->player) == self->nextBeat) {
+        batteur_beat_t* replaced = self->currentBeat;
+        self->currentBeat = self->nextBeat;
+        self->nextBeat = NULL;
+        publish_saved_beat(self);
+        release_beat(self, replaced);
+    }
+
+    // Songs of the setlist take over within the player, and the setlists
+    // they come from are only freed after this
+    publish_saved_beat(self);
 
-    *self->part_total_p = batteur_get_total_parts(self->currentBeat);
+    batteur_beat_t* playing_beat = batteur_get_current_beat(self->player);
+    if (playing_beat != self->shown_beat) {
+        self->shown_beat = playing_beat;
+        send_beat_name(self);
+        send_part_name(self);
+        send_song_name(self);
+    }
+
+    if (self->old_setlist && !setlist_in_use(self, self->old_setlist)) {
+        free_setlist(self, self->old_setlist);
+        self->old_setlist = NULL;
+    }
+
+    *self->part_total_p = batteur_get_total_parts(playing_beat);
     *self->part_index_p = *self->part_total_p == 0 ? 0 : batteur_get_part_index(self->player) + 1;
-    *self->fill_total_p = batteur_get_total_fills(self->currentBeat, *self->part_index_p - 1);
+    *self->fill_total_p = batteur_get_total_fills(playing_beat, *self->part_index_p - 1);
     *self->fill_index_p = *self->fill_total_p == 0 ? 0 : batteur_get_fill_index(self->player) + 1;
-    *self->time_num_p = batteur_get_time_numerator(self->currentBeat);
-    *self->time_denom_p = batteur_get_time_denominator(self->currentBeat);
+    *self->time_num_p = batteur_get_time_numerator(playing_beat);
+    *self->time_denom_p = batteur_get_time_denominator(playing_beat);
+    *self->song_total_p = batteur_setlist_get_total_songs(self->setlist);
+    *self->song_index_p = batteur_setlist_find_song(self->setlist, playing_beat) + 1;
     *self->beat_p = batteur_get_bar_position(self->player);
     *self->status_p = batteur_get_status(self->player);
 }
@@ -751,6 +1259,41 @@ lv2_set_options(LV2_Handle instance, const LV2_Options_Option* options)
     return LV2_OPTIONS_SUCCESS;
 }
 
+/**
+ * Leave the paths to load for run(), since restore() may run concurrently
+ * with it. A request that run() did not pick up yet is replaced.
+ */
+static void
+post_restore(batteur_plugin_t* self, batteur_beat_t* embedded, const char* beat_path, const char* setlist_path)
+{
+    if (strlen(beat_path) > MAX_PATH_SIZE || (setlist_path && strlen(setlist_path) > MAX_PATH_SIZE)) {
+        lv2_log_error(&self->logger, "File path size too big, ignoring.\n");
+        batteur_release_beat(embedded);
+        return;
+    }
+
+    for (;;) {
+        int expected = RESTORE_FREE;
+        if (atomic_compare_exchange_weak(&self->restore_state, &expected, RESTORE_WRITING))
+            break;
+
+        expected = RESTORE_READY;
+        if (atomic_compare_exchange_weak(&self->restore_state, &expected, RESTORE_WRITING)) {
+            batteur_release_beat(self->restore_request.embedded);
+            break;
+        }
+        // Otherwise run() is reading the previous request
+    }
+
+    restore_request_t* request = &self->restore_request;
+    request->embedded = embedded;
+    strncpy(request->beat_path, beat_path, MAX_PATH_SIZE);
+    request->beat_path[MAX_PATH_SIZE] = '\0';
+    strncpy(request->setlist_path, setlist_path ? setlist_path : "", MAX_PATH_SIZE);
+    request->setlist_path[MAX_PATH_SIZE] = '\0';
+    atomic_store(&self->restore_state, RESTORE_READY);
+}
+
 static LV2_State_Status
 restore(LV2_Handle instance,
     LV2_State_Retrieve_Function retrieve,
@@ -759,26 +1302,50 @@ restore(LV2_Handle instance,
     const LV2_Feature* const* features)
 {
     UNUSED(flags);
-    UNUSED(features);
     batteur_plugin_t* self = (batteur_plugin_t*)instance;
 
-    // Fetch back the saved file path, if any
-    size_t size;
+    // Fetch back the saved paths, if any
+    size_t beat_size = 0;
+    size_t setlist_size = 0;
+    size_t data_size = 0;
     uint32_t type;
+    uint32_t data_type = 0;
     uint32_t val_flags;
-    const void* value;
-    value = retrieve(handle, self->beat_description_uri, &size, &type, &val_flags);
-    if (value) {
-        lv2_log_note(&self->logger, "Restoring the file %s\n", (const char*)value);
-        batteur_beat_t* beat = batteur_load_beat((const char *)value);
-        if (beat) {
-            strcpy(self->beat_file_path, (const char *)value);
-            self->currentBeat = beat;
-            batteur_load(self->player, beat);
-            batteur_set_tempo(self->player, 
-                self->sync_to_host_tempo ? self->host_bpm : self->knob_bpm);
-        }
+    const char* beat_path = retrieve(handle, self->beat_description_uri, &beat_size, &type, &val_flags);
+    const char* setlist_path = retrieve(handle, self->setlist_uri, &setlist_size, &type, &val_flags);
+    const void* beat_data = retrieve(handle, self->beat_data_uri, &data_size, &data_type, &val_flags);
+    if (!beat_path || beat_size <= 1)
+        beat_path = "";
+    if (setlist_path && setlist_size <= 1)
+        setlist_path = NULL;
+
+    // A beat saved in the state is copied from it, and its file is not read;
+    // it is used as is, even if its file changed since.
+    batteur_beat_t* embedded = NULL;
+    if (beat_data && data_type == self->atom_chunk_uri) {
+        embedded = batteur_acquire_beat_from_data(beat_data, data_size);
+        if (!embedded)
+            lv2_log_warning(&self->logger, "Could not read the beat saved in the state, loading its file\n");
+    }
+
+    // With a worker given to restore, the files are loaded in the background
+    // and swapped in by work_response(), so that restoring does not block
+    LV2_Worker_Schedule* worker = NULL;
+    for (const LV2_Feature* const* f = features; f && *f; f++) {
+        if (!strcmp((**f).URI, LV2_WORKER__schedule))
+            worker = (**f).data;
     }
+
+    if (worker) {
+        if (embedded || beat_path[0])
+            schedule_load(self, worker, self->beat_description_uri, beat_path, (uint32_t)strlen(beat_path), embedded);
+        if (setlist_path)
+            schedule_load(self, worker, self->setlist_uri, setlist_path, (uint32_t)strlen(setlist_path), NULL);
+        return LV2_STATE_SUCCESS;
+    }
+
+    // Otherwise the worker of the instance loads them, scheduled from run()
+    post_restore(self, embedded, beat_path, setlist_path);
     return LV2_STATE_SUCCESS;
 }
 
@@ -800,6 +1367,38 @@ save(LV2_Handle instance,
         self->atom_path_uri,
         LV2_STATE_IS_POD);
 
+    // Save the setlist path
+    store(handle,
+        self->setlist_uri,
+        self->setlist_file_path,
+        strlen(self->setlist_file_path) + 1,
+        self->atom_path_uri,
+        LV2_STATE_IS_POD);
+
+    // Save the binary form of the beat that plays, so that the state can be
+    // restored without its file, or without the setlist it comes from. run() may hand the published beat
+    // back to the worker meanwhile, and a new beat may reuse its address, so
+    // the beat is retained and then checked to still be the published one.
+    batteur_beat_t* beat = NULL;
+    for (int attempt = 0; attempt < MAX_SAVE_ATTEMPTS && !beat; ++attempt) {
+        batteur_beat_t* published = atomic_load(&self->saved_beat);
+        if (!published)
+            break;
+        if (!batteur_retain_beat(published))
+            continue;
+        if (atomic_load(&self->saved_beat) == published)
+            beat = published;
+        else
+            batteur_release_beat(published);
+    }
+    if (beat) {
+        const void* data = NULL;
+        const size_t size = batteur_get_beat_data(beat, &data);
+        if (size > 0)
+            store(handle, self->beat_data_uri, data, size, self->atom_chunk_uri, LV2_STATE_IS_POD);
+        batteur_release_beat(beat);
+    }
+
     return LV2_STATE_SUCCESS;
 }
 
@@ -817,30 +1416,38 @@ work(LV2_Handle instance,
         return LV2_WORKER_ERR_UNKNOWN;
     }
 
-    // Free the next beat, if any
-    if (self->nextBeat) {
-        batteur_free_beat(self->nextBeat);
-        self->nextBeat = NULL;
-    }
-
     const LV2_Atom* atom = (const LV2_Atom*)data;
+    if (size < WORKER_MESSAGE_HEADER_SIZE || size > sizeof(worker_message_t)) {
+        lv2_log_error(&self->logger, "[worker] Got a message of unexpected size %d.\n", size);
+        return LV2_WORKER_ERR_UNKNOWN;
+    }
 
-    // Assume a path is for a beat
-    if (atom->type == self->beat_description_uri || atom->type == self->atom_path_uri) {
-        char* file_path = malloc(atom->size + 1);
-        const char* atom_body = (const char*)LV2_ATOM_BODY_CONST(atom);
-        batteur_beat_t* beat;
+    if (atom->type == self->release_beat_uri) {
+        batteur_release_beat(((const worker_message_t*)data)->object.beat);
+        return LV2_WORKER_SUCCESS;
+    }
 
-        file_path[0] = '\0';
-        strncat(file_path, atom_body, atom->size);
-        lv2_log_note(&self->logger, "Loading: %s\n", file_path);
-        beat = batteur_load_beat(file_path);
+    if (atom->type == self->free_setlist_uri) {
+        batteur_setlist_free(((const worker_message_t*)data)->object.setlist);
+        return LV2_WORKER_SUCCESS;
+    }
 
-        if (beat) {
-            self->nextBeat = beat;
+    if (atom->type == self->copy_beat_uri) {
+        worker_message_t message;
+        memcpy(&message, data, WORKER_MESSAGE_HEADER_SIZE);
+        const void* beat_data = NULL;
+        const size_t beat_size = batteur_get_beat_data(message.object.beat, &beat_data);
+        message.object.beat = batteur_acquire_beat_from_data(beat_data, beat_size);
+        if (!message.object.beat) {
+            lv2_log_error(&self->logger, "Could not copy the beat of the song to save it\n");
+            return LV2_WORKER_ERR_UNKNOWN;
         }
-        free(file_path);
-    } else {
+
+        respond(handle, WORKER_MESSAGE_HEADER_SIZE, &message);
+        return LV2_WORKER_SUCCESS;
+    }
+
+    if (atom->type != self->beat_description_uri && atom->type != self->setlist_uri) {
         lv2_log_error(&self->logger, "[worker] Got an unknown atom.\n");
         if (self->unmap)
             lv2_log_error(&self->logger,
@@ -849,7 +1456,29 @@ work(LV2_Handle instance,
         return LV2_WORKER_ERR_UNKNOWN;
     }
 
-    respond(handle, size, data);
+    // Load the file, and send it to the audio thread along with its path
+    worker_message_t message;
+    memcpy(&message, data, size);
+    bool loaded;
+    if (atom->type == self->beat_description_uri) {
+        // A beat restored from the state is already loaded
+        if (!message.object.beat) {
+            lv2_log_note(&self->logger, "Loading: %s\n", message.path);
+            message.object.beat = batteur_acquire_beat(message.path);
+        }
+        loaded = message.object.beat != NULL;
+    } else {
+        lv2_log_note(&self->logger, "Loading: %s\n", message.path);
+        message.object.setlist = batteur_setlist_load(message.path);
+        loaded = message.object.setlist != NULL;
+    }
+
+    if (!loaded) {
+        lv2_log_error(&self->logger, "Could not load %s\n", message.path);
+        return LV2_WORKER_ERR_UNKNOWN;
+    }
+
+    respond(handle, size, &message);
     return LV2_WORKER_SUCCESS;
 }
 
@@ -866,29 +1495,16 @@ work_response(LV2_Handle instance,
         return LV2_WORKER_ERR_UNKNOWN;
 
     const LV2_Atom* atom = (const LV2_Atom*)data;
-    // Assume a path is for a beat
-    if (atom->type == self->beat_description_uri || atom->type == self->atom_path_uri) {
-        if (self->nextBeat) {
-            batteur_beat_t* beat = self->currentBeat;
-            if (batteur_load(self->player, self->nextBeat)) {
-                self->currentBeat = self->nextBeat;
-                self->nextBeat = beat; // will be cleaned up on the next load
-                batteur_set_tempo(self->player, 
-                    self->sync_to_host_tempo ? self->host_bpm : self->knob_bpm);
-
-                // Update the file path
-                // TODO: could swap the name with the beat to be honest...
-                uint32_t size = atom->size;
-                if (size >= (MAX_PATH_SIZE)) {
-                    lv2_log_error(&self->logger, "File path size too big (%d)! Filename will be truncated.", size);
-                    size = MAX_PATH_SIZE;
-                }
-                    
-                const char* beat_file_path = LV2_ATOM_BODY_CONST(atom);
-                strncpy(self->beat_file_path, beat_file_path, size);
-                self->beat_file_path[size] = '\0';
-            }
+    const worker_message_t* message = (const worker_message_t*)data;
+    if (atom->type == self->setlist_uri) {
+        if (!install_setlist(self, message->object.setlist, message->path)) {
+            lv2_log_error(&self->logger, "The previous setlist is still in use, try again later.\n");
+            free_setlist(self, message->object.setlist);
         }
+    } else if (atom->type == self->beat_description_uri) {
+        install_beat(self, message->object.beat, message->path);
+    } else if (atom->type == self->copy_beat_uri) {
+        install_song_copy(self, message->object.beat, message->copy_generation);
     } else {
         lv2_log_error(&self->logger, "[work_response] Got an unknown atom.\n");
         if (self->unmap)
@@ -0,0 +1,176 @@
+#include "BeatCache.h"
+#include "BeatDescription.h"
+#include "BinaryBeat.h"
+#include "FileReadingHelpers.h"
+#include <cstring>
+#include <map>
+#include <mutex>
+
+namespace batteur {
+
+namespace {
+
+struct CachedBeat {
+    std::string path;
+    FileStamp stamp;
+    std::unique_ptr<const BeatDescription> beat;
+    unsigned users;
+};
+
+class BeatCache {
+public:
+    const BeatDescription* acquire(const fs::path& file, std::error_code& error)
+    {
+        if (!fs::exists(file)) {
+            error = BeatDescriptionError::NonexistentFile;
+            return {};
+        }
+
+        FileStamp stamp {};
+        const auto path = fs::canonical(file, error);
+        if (!error)
+            stamp = readStamp(path, error);
+        if (error)
+            return {};
+
+        const std::string key { path.string() };
+        const auto sameFile = [&stamp](const CachedBeat& cached) {
+            return cached.stamp == stamp;
+        };
+        if (const auto cached = use(key, sameFile))
+            return cached;
+
+        std::unique_ptr<const BeatDescription> beat { BeatDescription::buildFromFile(path, error) };
+        if (!beat)
+            return {};
+
+        return insert(key, stamp, beat, sameFile);
+    }
+
+    const BeatDescription* acquire(const void* data, std::size_t size, std::error_code& error)
+    {
+        // Keyed by a hash of the bytes, which are compared on a match
+        uint64_t hash { 14695981039346656037ull };
+        const auto bytes = static_cast<const uint8_t*>(data);
+        for (std::size_t i = 0; bytes && i < size; ++i)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        const std::string key { "data:" + std::to_string(hash) };
+
+        const auto sameData = [data, size](const CachedBeat& cached) {
+            const auto& storage = *cached.beat->storage;
+            return storage.size() == size && std::memcmp(storage.data(), data, size) == 0;
+        };
+        if (const auto cached = use(key, sameData))
+            return cached;
+
+        std::unique_ptr<const BeatDescription> beat { BeatDescription::buildFromBinary(data, size, error) };
+        if (!beat)
+            return {};
+
+        return insert(key, FileStamp { size, {} }, beat, sameData);
+    }
+
+    bool retain(const BeatDescription* beat)
+    {
+        std::lock_guard<std::mutex> lock { mutex };
+        const auto cached = beats.find(beat);
+        if (cached == beats.end())
+            return false;
+
+        cached->second.users++;
+        return true;
+    }
+
+    void release(const BeatDescription* beat)
+    {
+        if (!beat)
+            return;
+
+        std::lock_guard<std::mutex> lock { mutex };
+        const auto cached = beats.find(beat);
+        ASSERT(cached != beats.end());
+        if (cached == beats.end() || --cached->second.users > 0)
+            return;
+
+        const auto current = latest.find(cached->second.path);
+        if (current != latest.end() && current->second == beat)
+            latest.erase(current);
+
+        beats.erase(cached);
+    }
+
+private:
+    // Take a reference on the latest beat of a key, if it matches
+    template <class Match>
+    const BeatDescription* use(const std::string& key, const Match& match)
+    {
+        std::lock_guard<std::mutex> lock { mutex };
+        return useLocked(key, match);
+    }
+
+    template <class Match>
+    const BeatDescription* useLocked(const std::string& key, const Match& match)
+    {
+        const auto current = latest.find(key);
+        if (current == latest.end())
+            return {};
+
+        auto& cached = beats.at(current->second);
+        if (!match(cached))
+            return {};
+
+        cached.users++;
+        return current->second;
+    }
+
+    // Beats are loaded without the lock, so another thread may have added the
+    // same beat meanwhile; that one is used and `beat` is left to the caller
+    // to free once the lock is released.
+    template <class Match>
+    const BeatDescription* insert(const std::string& key, const FileStamp& stamp,
+        std::unique_ptr<const BeatDescription>& beat, const Match& match)
+    {
+        std::lock_guard<std::mutex> lock { mutex };
+        if (const auto cached = useLocked(key, match))
+            return cached;
+
+        const BeatDescription* pointer = beat.get();
+        beats[pointer] = { key, stamp, std::move(beat), 1 };
+        latest[key] = pointer;
+        return pointer;
+    }
+
+    std::mutex mutex;
+    std::map<const BeatDescription*, CachedBeat> beats;
+    std::map<std::string, const BeatDescription*> latest; // Most recent version of each file
+};
+
+BeatCache& beatCache()
+{
+    static BeatCache cache;
+    return cache;
+}
+
+}
+
+const BeatDescription* acquireBeat(const fs::path& file, std::error_code& error)
+{
+    return beatCache().acquire(file, error);
+}
+
+const BeatDescription* acquireBeatData(const void* data, std::size_t size, std::error_code& error)
+{
+    return beatCache().acquire(data, size, error);
+}
+
+bool retainBeat(const BeatDescription* beat)
+{
+    return beatCache().retain(beat);
+}
+
+void releaseBeat(const BeatDescription* beat)
+{
+    beatCache().release(beat);
+}
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <system_error>
+#include "filesystem.hpp"
+
+namespace fs = ghc::filesystem;
+
+namespace batteur {
+
+struct BeatDescription;
+
+/**
+ * @brief Load a beat through a cache shared by the whole process.
+ *
+ * Beats are keyed by the canonical path of their file, and by its size and
+ * modification time: acquiring an unchanged file again returns the same beat,
+ * so that several players share its notes. A file that changed on disk is
+ * loaded anew, while the users of the previous version keep it until they
+ * release it. The beats are read-only.
+ *
+ * Beats are loaded outside of the cache's lock, so a slow load does not hold
+ * back the other threads. If several threads load the same beat at once, they
+ * all get the copy that was added first and the other copies are freed.
+ *
+ * @return null on error; otherwise the beat must be given back to `releaseBeat`
+ */
+const BeatDescription* acquireBeat(const fs::path& file, std::error_code& error);
+
+/**
+ * @brief Load a beat from the bytes of its binary form, kept outside of any
+ * file. Beats with the same bytes are shared, like beats from the same file.
+ *
+ * @return null on error; otherwise the beat must be given back to `releaseBeat`
+ */
+const BeatDescription* acquireBeatData(const void* data, std::size_t size, std::error_code& error);
+
+/**
+ * @brief Take one more reference on a beat from the cache
+ *
+ * @return false if the beat is not, or no longer, in the cache
+ */
+bool retainBeat(const BeatDescription* beat);
+
+/**
+ * @brief Release a beat from `acquireBeat` or `acquireBeatData`. It is freed when its last user
+ * releases it. Releasing null does nothing.
+ */
+void releaseBeat(const BeatDescription* beat);
+
+}
@@ -1,9 +1,13 @@
 #include "BeatDescription.h"
+#include "BinaryBeat.h"
+#include "JsonBeatReader.h"
 #include "MathHelpers.h"
 #include <fmidi/fmidi.h>
 #include "tl/expected.hpp"
 #include "FileReadingHelpers.h"
 #include "json.hpp"
+#include <cmath>
+#include <iterator>
 
 using nlohmann::json;
 
@@ -31,6 +35,18 @@ std::string BeatDescriptionErrorCategory::message(int ev) const
     case batteur::BeatDescriptionError::NoParts:
         return "No parts found in the JSON dictionary";
 
+    case batteur::BeatDescriptionError::InvalidBinaryFile:
+        return "Invalid or truncated binary beat file";
+
+    case batteur::BeatDescriptionError::UnsupportedBinaryVersion:
+        return "Unsupported binary beat version or byte order";
+
+    case batteur::BeatDescriptionError::InvalidJson:
+        return "The file is not valid JSON";
+
+    case batteur::BeatDescriptionError::InvalidBeat:
+        return "The beat has an empty sequence or an invalid tempo or signature";
+
     default:
         return "Unknown error";
     }
@@ -77,17 +93,34 @@ void alignSequenceEnd(Sequence& sequence, double numBars, double quartersPerBar)
         note.timestamp += shift;
 }
 
+int64_t quartersToTicks(double quarters) noexcept
+{
+    return static_cast<int64_t>(std::llround(quarters * ticksPerQuarter));
+}
+
+bool BeatDescription::compile(std::error_code& error)
+{
+    // The encoder writes what it is given, so it is up to the reader to
+    // refuse what the player could not play
+    if (!bindBinaryBeat(*this, encodeBinaryBeat(*this), error)) {
+        error = BeatDescriptionError::InvalidBeat;
+        return false;
+    }
+
+    return true;
+}
+
 std::unique_ptr<BeatDescription> buildDescriptionFromJson(const fs::path& virtualFile, const nlohmann::json& json, std::error_code& error)
 {
     auto beat = std::unique_ptr<BeatDescription>(new BeatDescription());
 
     // Minimal file
-    const auto title = json["name"];
-    if (title.is_null()) {
+    const auto title = json.find("name");
+    if (title == json.end() || !title->is_string()) {
         error = BeatDescriptionError::NoFilename;
         return {};
     }
-    beat->name = title;
+    beat->name = *title;
 
     const auto group = json.find("group");
     if (group != json.end())
@@ -132,16 +165,22 @@ std::unique_ptr<BeatDescription> buildDescriptionFromJson(const fs::path& virtua
 
     for (auto& part : *parts) {
         Part newPart;
-        newPart.name = part["name"];
+        const auto name = part.find("name");
+        if (name != part.end() && name->is_string())
+            newPart.name = *name;
+
         auto mainLoop = readSequenceByName(part, rootDirectory, "sequence");
         if (!mainLoop)
             continue;
 
         newPart.mainLoop = std::move(*mainLoop);
 
-        for (auto& fill : part["fills"]) {
-            if (auto seq = readSequence(fill, rootDirectory)) {
-                newPart.fills.push_back(std::move(*seq));
+        const auto fills = part.find("fills");
+        if (fills != part.end() && fills->is_array()) {
+            for (auto& fill : *fills) {
+                if (auto seq = readSequence(fill, rootDirectory)) {
+                    newPart.fills.push_back(std::move(*seq));
+                }
             }
         }
 
@@ -156,6 +195,9 @@ std::unique_ptr<BeatDescription> buildDescriptionFromJson(const fs::path& virtua
         return {};
     }
 
+    if (!beat->compile(error))
+        return {};
+
     return beat;
 }
 
@@ -166,16 +208,45 @@ std::unique_ptr<BeatDescription> BeatDescription::buildFromFile(const fs::path&
         return {};
     }
 
-    fs::fstream inputStream { file, std::ios::ios_base::in };
-    nlohmann::json json;
-    inputStream >> json;
-    return buildDescriptionFromJson(file, json, error);
+    uint8_t magic[sizeof(binary::magic)] {};
+    fs::fstream inputStream { file, std::ios::ios_base::in | std::ios::ios_base::binary };
+    inputStream.read(reinterpret_cast<char*>(magic), sizeof(magic));
+    if (isBinaryBeat(magic, static_cast<std::size_t>(inputStream.gcount()))) {
+        inputStream.close();
+        auto storage = mapBeatFile(file, error);
+        if (!storage)
+            return {};
+
+        auto beat = std::unique_ptr<BeatDescription>(new BeatDescription());
+        if (!bindBinaryBeat(*beat, std::move(storage), error))
+            return {};
+
+        return beat;
+    }
+
+    inputStream.clear();
+    inputStream.seekg(0);
+    const std::string text { std::istreambuf_iterator<char>(inputStream), std::istreambuf_iterator<char>() };
+    return readBeatDescription(text.data(), text.data() + text.size(), file, error);
 }
 
 std::unique_ptr<BeatDescription> BeatDescription::buildFromString(const fs::path& virtualFile, const std::string& string, std::error_code& error)
 {
-    return buildDescriptionFromJson(
-        virtualFile, nlohmann::json::parse(string, nullptr, false), error);
+    return readBeatDescription(string.data(), string.data() + string.size(), virtualFile, error);
+}
+
+std::unique_ptr<BeatDescription> BeatDescription::buildFromBinary(const void* data, std::size_t size, std::error_code& error)
+{
+    if (!data) {
+        error = BeatDescriptionError::InvalidBinaryFile;
+        return {};
+    }
+
+    auto beat = std::unique_ptr<BeatDescription>(new BeatDescription());
+    if (!bindBinaryBeat(*beat, copyBeatData(data, size), error))
+        return {};
+
+    return beat;
 }
   
 }
\ No newline at end of file
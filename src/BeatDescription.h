@@ -1,9 +1,11 @@
 #pragma once
+#include <memory>
 #include <vector>
 #include <string>
 #include <fstream>
 #include "filesystem.hpp"
 #include "Debug.h"
+#include "PlaybackSequence.h"
 #include "tl/optional.hpp"
 
 namespace fs = ghc::filesystem;
@@ -36,6 +38,16 @@ struct TimeSignature {
     int denom;
 };
 
+class BeatStorage;
+
+/**
+ * @brief A beat, read from a JSON description or from its binary form.
+ *
+ * The player only uses `playback`, which points into `storage`. The note lists
+ * (`intro`, `ending` and the sequences of `parts`) are only filled when
+ * reading a JSON description; a beat read from a binary file is used in place
+ * and only holds the names of its parts.
+ */
 struct BeatDescription {
     std::string name;
     std::string group;
@@ -45,14 +57,32 @@ struct BeatDescription {
     tl::optional<Sequence> intro;
     std::vector<Part> parts;
     tl::optional<Sequence> ending;
+    BeatPlayback playback; // Compiled sequences, used by the player
+    std::shared_ptr<const BeatStorage> storage; // Binary form of the beat
+    /**
+     * @brief Build the binary form and the playback sequences from the notes
+     *
+     * @return false if the beat cannot be played, for instance with an empty
+     * sequence or an invalid tempo
+     */
+    bool compile(std::error_code& error);
     static std::unique_ptr<BeatDescription> buildFromFile(const fs::path& file, std::error_code& error);
     static std::unique_ptr<BeatDescription> buildFromString(const fs::path& virtualFile, const std::string& string, std::error_code& error);
+    /**
+     * @brief Read a beat from the bytes of its binary form, such as those of
+     * `storage`. The bytes are copied, and the copy is used in place.
+     */
+    static std::unique_ptr<BeatDescription> buildFromBinary(const void* data, std::size_t size, std::error_code& error);
 };
 
 enum class BeatDescriptionError {
     NonexistentFile = 1,
     NoFilename,
-    NoParts
+    NoParts,
+    InvalidBinaryFile,
+    UnsupportedBinaryVersion,
+    InvalidJson,
+    InvalidBeat
 };
 
 std::error_code make_error_code(BeatDescriptionError);
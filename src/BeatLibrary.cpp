@@ -0,0 +1,310 @@
+#include "BeatLibrary.h"
+#include "BinaryBeat.h"
+#include "FileReadingHelpers.h"
+#include "JsonBeatReader.h"
+#include "json.hpp"
+#include <algorithm>
+
+using nlohmann::json;
+
+namespace batteur {
+
+namespace {
+
+constexpr int indexVersion { 1 };
+
+/**
+ * @brief What the index knows about a file. Files that are not beats are kept
+ * without metadata, so that they are not read again on each scan.
+ */
+struct IndexEntry {
+    FileStamp stamp;
+    tl::optional<BeatInfo> info;
+};
+
+// Keyed by the path relative to the library directory, in generic form
+using Index = std::map<std::string, IndexEntry>;
+
+tl::optional<BeatInfo> readInfo(const fs::path& file)
+{
+    std::error_code ec;
+    const auto storage = mapBeatFile(file, ec);
+    if (!storage)
+        return {};
+
+    BeatInfo info;
+    if (isBinaryBeat(storage->data(), storage->size())) {
+        BeatDescription beat;
+        if (!bindBinaryBeat(beat, storage, ec))
+            return {};
+
+        info.name = std::move(beat.name);
+        info.group = std::move(beat.group);
+        info.bpm = beat.bpm;
+        info.quartersPerBar = beat.quartersPerBar;
+        info.signature = beat.signature;
+        for (std::size_t i = 0; i < beat.parts.size(); ++i) {
+            const auto numFills = static_cast<int>(beat.playback.parts[i].fills.size());
+            info.parts.push_back({ std::move(beat.parts[i].name), numFills });
+        }
+    } else {
+        const auto begin = reinterpret_cast<const char*>(storage->data());
+        if (!readBeatMetadata(begin, begin + storage->size(), file, info, ec))
+            return {};
+    }
+
+    return info;
+}
+
+json infoToJson(const BeatInfo& info)
+{
+    json parts = json::array();
+    for (const auto& part : info.parts)
+        parts.push_back({ { "name", part.name }, { "fills", part.numFills } });
+
+    return {
+        { "name", info.name },
+        { "group", info.group },
+        { "bpm", info.bpm },
+        { "quarters_per_bar", info.quartersPerBar },
+        { "signature", { info.signature.num, info.signature.denom } },
+        { "parts", std::move(parts) },
+    };
+}
+
+BeatInfo infoFromJson(const json& object)
+{
+    BeatInfo info;
+    info.name = object.at("name").get<std::string>();
+    info.group = object.at("group").get<std::string>();
+    info.bpm = object.at("bpm").get<float>();
+    info.quartersPerBar = object.at("quarters_per_bar").get<double>();
+    info.signature.num = object.at("signature").at(0).get<int>();
+    info.signature.denom = object.at("signature").at(1).get<int>();
+    for (const auto& part : object.at("parts"))
+        info.parts.push_back({ part.at("name").get<std::string>(), part.at("fills").get<int>() });
+
+    return info;
+}
+
+/**
+ * @brief Read an index written by `writeIndex` for the same directory. Anything
+ * unexpected gives an empty index, and the library is then read anew.
+ */
+Index readIndex(const fs::path& indexFile, const fs::path& directory)
+{
+    std::error_code ec;
+    const auto storage = mapBeatFile(indexFile, ec);
+    if (!storage)
+        return {};
+
+    const auto begin = reinterpret_cast<const char*>(storage->data());
+    const auto document = json::parse(begin, begin + storage->size(), nullptr, false);
+    if (!document.is_object())
+        return {};
+
+    Index index;
+    try {
+        if (document.at("version").get<int>() != indexVersion
+            || document.at("directory").get<std::string>() != directory.string())
+            return {};
+
+        for (const auto& object : document.at("files")) {
+            IndexEntry entry;
+            entry.stamp.size = object.at("size").get<uintmax_t>();
+            entry.stamp.modified = fs::file_time_type { fs::file_time_type::duration { object.at("modified").get<int64_t>() } };
+            const auto beat = object.find("beat");
+            if (beat != object.end())
+                entry.info = infoFromJson(*beat);
+
+            index[object.at("file").get<std::string>()] = std::move(entry);
+        }
+    } catch (const json::exception&) {
+        return {};
+    }
+
+    return index;
+}
+
+/**
+ * @brief Write the index next to its destination and rename it, so that a
+ * concurrent scan never reads half of it.
+ */
+void writeIndex(const fs::path& indexFile, const fs::path& directory, const Index& index)
+{
+    json files = json::array();
+    for (const auto& file : index) {
+        json object {
+            { "file", file.first },
+            { "size", file.second.stamp.size },
+            { "modified", static_cast<int64_t>(file.second.stamp.modified.time_since_epoch().count()) },
+        };
+        if (file.second.info)
+            object["beat"] = infoToJson(*file.second.info);
+
+        files.push_back(std::move(object));
+    }
+
+    const json document {
+        { "version", indexVersion },
+        { "directory", directory.string() },
+        { "files", std::move(files) },
+    };
+
+    fs::path temporary { indexFile };
+    temporary += ".tmp";
+    {
+        std::ofstream stream { temporary.string(), std::ios::binary | std::ios::trunc };
+        stream << document.dump();
+        if (!stream)
+            return;
+    }
+
+    std::error_code ec;
+    fs::rename(temporary, indexFile, ec);
+    if (ec)
+        fs::remove(temporary, ec);
+}
+
+}
+
+std::unique_ptr<BeatLibrary> BeatLibrary::scan(const fs::path& directory, const fs::path& indexFile, std::error_code& error)
+{
+    if (!fs::is_directory(directory)) {
+        error = BeatDescriptionError::NonexistentFile;
+        return {};
+    }
+
+    const auto root = fs::canonical(directory, error);
+    if (error)
+        return {};
+
+    std::error_code ec;
+    const auto indexPath = indexFile.empty() ? fs::path {} : fs::weakly_canonical(indexFile, ec);
+    auto previous = indexFile.empty() ? Index {} : readIndex(indexFile, root);
+    Index current;
+    std::size_t reused { 0 };
+
+    auto library = std::unique_ptr<BeatLibrary>(new BeatLibrary());
+    const auto options = fs::directory_options::skip_permission_denied;
+    for (fs::recursive_directory_iterator it { root, options, ec }, end; !ec && it != end; it.increment(ec)) {
+        const auto& path = it->path();
+        const auto extension = path.extension();
+        if ((extension != ".json" && extension != ".btb") || path == indexPath)
+            continue;
+
+        if (!it->is_regular_file(ec)) {
+            ec.clear();
+            continue;
+        }
+
+        const auto stamp = readStamp(path, ec);
+        if (ec) {
+            ec.clear();
+            continue;
+        }
+
+        const auto relative = path.lexically_relative(root).generic_string();
+        const auto indexed = previous.find(relative);
+        if (indexed != previous.end() && indexed->second.stamp == stamp) {
+            current[relative] = std::move(indexed->second);
+            reused++;
+            continue;
+        }
+
+        current[relative] = { stamp, readInfo(path) };
+        library->filesRead++;
+    }
+
+    if (ec) {
+        error = ec;
+        return {};
+    }
+
+    if (!indexFile.empty() && (library->filesRead > 0 || reused != previous.size()))
+        writeIndex(indexFile, root, current);
+
+    for (auto& file : current) {
+        if (!file.second.info)
+            continue;
+
+        file.second.info->file = (root / file.first).string();
+        library->entries.push_back(std::move(*file.second.info));
+    }
+
+    library->buildIndices();
+    return library;
+}
+
+void BeatLibrary::buildIndices()
+{
+    byGroup.clear();
+    bySignature.clear();
+    byBpm.clear();
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        byGroup[entries[i].group].push_back(i);
+        bySignature[{ entries[i].signature.num, entries[i].signature.denom }].push_back(i);
+        byBpm.push_back(i);
+    }
+
+    std::stable_sort(byBpm.begin(), byBpm.end(), [this](std::size_t lhs, std::size_t rhs) {
+        return entries[lhs].bpm < entries[rhs].bpm;
+    });
+}
+
+bool BeatLibrary::matches(const BeatInfo& beat, const BeatQuery& query) const
+{
+    if (query.group && beat.group != *query.group)
+        return false;
+
+    if (query.minBpm && beat.bpm < *query.minBpm)
+        return false;
+
+    if (query.maxBpm && beat.bpm > *query.maxBpm)
+        return false;
+
+    if (query.signature && (beat.signature.num != query.signature->num || beat.signature.denom != query.signature->denom))
+        return false;
+
+    return true;
+}
+
+std::vector<std::size_t> BeatLibrary::find(const BeatQuery& query) const
+{
+    // Start from the narrowest index available, and check the other criteria
+    std::vector<std::size_t> candidates;
+    if (query.group) {
+        const auto group = byGroup.find(*query.group);
+        if (group != byGroup.end())
+            candidates = group->second;
+    } else if (query.signature) {
+        const auto signature = bySignature.find({ query.signature->num, query.signature->denom });
+        if (signature != bySignature.end())
+            candidates = signature->second;
+    } else if (query.minBpm || query.maxBpm) {
+        auto first = byBpm.begin();
+        auto last = byBpm.end();
+        if (query.minBpm) {
+            first = std::lower_bound(first, last, *query.minBpm, [this](std::size_t index, float bpm) {
+                return entries[index].bpm < bpm;
+            });
+        }
+        if (query.maxBpm) {
+            last = std::upper_bound(first, last, *query.maxBpm, [this](float bpm, std::size_t index) {
+                return bpm < entries[index].bpm;
+            });
+        }
+        candidates.assign(first, last);
+        std::sort(candidates.begin(), candidates.end());
+    } else {
+        candidates = byBpm;
+        std::sort(candidates.begin(), candidates.end());
+    }
+
+    candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&](std::size_t index) {
+        return !matches(entries[index], query);
+    }), candidates.end());
+    return candidates;
+}
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include "BeatDescription.h"
+#include "tl/optional.hpp"
+
+namespace batteur {
+
+struct PartInfo {
+    std::string name;
+    int numFills;
+};
+
+/**
+ * @brief The metadata of a beat, as listed by a library.
+ */
+struct BeatInfo {
+    std::string file; // Absolute path
+    std::string name;
+    std::string group;
+    float bpm;
+    double quartersPerBar;
+    TimeSignature signature;
+    std::vector<PartInfo> parts;
+};
+
+/**
+ * @brief Criteria for `BeatLibrary::find`; unset criteria match every beat.
+ * The bpm range is inclusive.
+ */
+struct BeatQuery {
+    tl::optional<std::string> group;
+    tl::optional<float> minBpm;
+    tl::optional<float> maxBpm;
+    tl::optional<TimeSignature> signature;
+};
+
+/**
+ * @brief The beats found in a directory tree.
+ *
+ * Only the metadata of the beats is read. The notes of JSON descriptions are
+ * skipped and the MIDI files they reference are only checked for existence,
+ * so that a part whose notes are malformed or whose MIDI file is corrupt is
+ * still listed. Binary beats are mapped and their header read.
+ *
+ * The metadata can be kept in an index file. Files whose size and
+ * modification time match their index entry are not read again, and the index
+ * is rewritten after a scan that found changes. The index is only a cache: one
+ * that cannot be read is rebuilt, and one that cannot be written is left as is.
+ */
+class BeatLibrary {
+public:
+    /**
+     * @brief Scan a directory and its subdirectories for beats (`.json` and
+     * `.btb` files). Files that are not valid beats are left out.
+     *
+     * @param indexFile where to keep the index; no index is used if empty
+     * @return null if the directory does not exist
+     */
+    static std::unique_ptr<BeatLibrary> scan(const fs::path& directory, const fs::path& indexFile, std::error_code& error);
+
+    /**
+     * @brief The beats, sorted by path
+     */
+    const std::vector<BeatInfo>& beats() const noexcept { return entries; }
+
+    /**
+     * @brief The indices of the beats matching a query, in increasing order
+     */
+    std::vector<std::size_t> find(const BeatQuery& query) const;
+
+    /**
+     * @brief The number of files read by the scan, rather than taken from the index
+     */
+    std::size_t numFilesRead() const noexcept { return filesRead; }
+
+private:
+    void buildIndices();
+    bool matches(const BeatInfo& beat, const BeatQuery& query) const;
+
+    std::vector<BeatInfo> entries;
+    std::map<std::string, std::vector<std::size_t>> byGroup;
+    std::map<std::pair<int, int>, std::vector<std::size_t>> bySignature;
+    std::vector<std::size_t> byBpm; // Sorted by bpm
+    std::size_t filesRead { 0 };
+};
+
+}
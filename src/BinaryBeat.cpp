@@ -0,0 +1,478 @@
+#include "BinaryBeat.h"
+#include "BeatDescription.h"
+#include "MathHelpers.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+#if defined _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace batteur {
+
+namespace {
+
+class MemoryStorage : public BeatStorage {
+public:
+    explicit MemoryStorage(std::size_t size)
+    : words((size + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0), bytes(size) {}
+    const uint8_t* data() const noexcept final { return reinterpret_cast<const uint8_t*>(words.data()); }
+    uint8_t* data() noexcept { return reinterpret_cast<uint8_t*>(words.data()); }
+    std::size_t size() const noexcept final { return bytes; }
+private:
+    std::vector<uint64_t> words; // Keeps the data aligned
+    std::size_t bytes;
+};
+
+#if defined _WIN32
+class MappedFile : public BeatStorage {
+public:
+    MappedFile(HANDLE file, HANDLE mapping, const void* view, std::size_t size) noexcept
+    : file(file), mapping(mapping), view(view), bytes(size) {}
+    ~MappedFile()
+    {
+        UnmapViewOfFile(view);
+        CloseHandle(mapping);
+        CloseHandle(file);
+    }
+    const uint8_t* data() const noexcept final { return static_cast<const uint8_t*>(view); }
+    std::size_t size() const noexcept final { return bytes; }
+private:
+    HANDLE file;
+    HANDLE mapping;
+    const void* view;
+    std::size_t bytes;
+};
+#else
+class MappedFile : public BeatStorage {
+public:
+    MappedFile(const void* view, std::size_t size) noexcept
+    : view(view), bytes(size) {}
+    ~MappedFile() { munmap(const_cast<void*>(view), bytes); }
+    const uint8_t* data() const noexcept final { return static_cast<const uint8_t*>(view); }
+    std::size_t size() const noexcept final { return bytes; }
+private:
+    const void* view;
+    std::size_t bytes;
+};
+#endif
+
+constexpr std::size_t bytesPerNote { 2 * sizeof(int64_t) + sizeof(float) + sizeof(uint8_t) };
+
+template <class T>
+bool readAt(const BeatStorage& storage, uint64_t offset, T& value) noexcept
+{
+    if (offset > storage.size() || storage.size() - offset < sizeof(T))
+        return false;
+
+    std::memcpy(&value, storage.data() + offset, sizeof(T));
+    return true;
+}
+
+// Checked on the bits, as -ffast-math lets the compiler assume there are no
+// NaNs nor infinities to compare with
+bool isPositiveNormal(double value) noexcept
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const uint64_t exponent = (bits >> 52) & 0x7FF;
+    return (bits >> 63) == 0 && exponent != 0 && exponent != 0x7FF;
+}
+
+bool readString(const BeatStorage& storage, uint32_t offset, std::string& string)
+{
+    uint32_t length;
+    if (!readAt(storage, offset, length))
+        return false;
+
+    const uint64_t start = uint64_t { offset } + sizeof(uint32_t);
+    if (storage.size() - start < uint64_t { length } + 1)
+        return false;
+
+    const auto chars = reinterpret_cast<const char*>(storage.data() + start);
+    string.assign(chars, length);
+    return true;
+}
+
+bool readSequence(const BeatStorage& storage, const binary::Header& header, uint32_t index, PlaybackSequence& sequence) noexcept
+{
+    binary::SequenceEntry entry;
+    if (index >= header.numSequences
+        || !readAt(storage, header.sequenceTable + index * sizeof(entry), entry))
+        return false;
+
+    if (entry.count == 0 || entry.durationTicks <= 0 || entry.notes % 8 != 0 || entry.notes > storage.size()
+        || (storage.size() - entry.notes) / bytesPerNote < entry.count)
+        return false;
+
+    const uint8_t* notes = storage.data() + entry.notes;
+    const std::size_t count = entry.count;
+    sequence.onTicks = { reinterpret_cast<const int64_t*>(notes), count };
+    sequence.offTicks = { reinterpret_cast<const int64_t*>(notes + count * sizeof(int64_t)), count };
+    sequence.velocities = { reinterpret_cast<const float*>(notes + 2 * count * sizeof(int64_t)), count };
+    sequence.numbers = { notes + 2 * count * sizeof(int64_t) + count * sizeof(float), count };
+    sequence.durationTicks = entry.durationTicks;
+
+    // The player goes through the notes in order and loops at the duration
+    int64_t previous = 0;
+    for (const auto onTick : sequence.onTicks) {
+        if (onTick < previous || onTick > entry.durationTicks)
+            return false;
+        previous = onTick;
+    }
+    return true;
+}
+
+bool readOptionalSequence(const BeatStorage& storage, const binary::Header& header, uint32_t index, tl::optional<PlaybackSequence>& sequence) noexcept
+{
+    if (index == binary::noSequence) {
+        sequence.reset();
+        return true;
+    }
+
+    PlaybackSequence read;
+    if (!readSequence(storage, header, index, read))
+        return false;
+
+    sequence = read;
+    return true;
+}
+
+// FNV-1a over the note values, to find identical sequences
+uint64_t hashSequence(const Sequence& sequence) noexcept
+{
+    uint64_t hash { 14695981039346656037ULL };
+    const auto add = [&hash](const void* data, std::size_t size) {
+        const auto bytes = static_cast<const uint8_t*>(data);
+        for (std::size_t i = 0; i < size; ++i)
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    };
+    for (const auto& note : sequence) {
+        add(&note.timestamp, sizeof(note.timestamp));
+        add(&note.duration, sizeof(note.duration));
+        add(&note.number, sizeof(note.number));
+        add(&note.velocity, sizeof(note.velocity));
+    }
+    return hash;
+}
+
+bool sameNotes(const Sequence& lhs, const Sequence& rhs) noexcept
+{
+    return lhs.size() == rhs.size()
+        && std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](const Note& l, const Note& r) {
+               return l.timestamp == r.timestamp && l.duration == r.duration
+                   && l.number == r.number && l.velocity == r.velocity;
+           });
+}
+
+// Writes the binary form in a buffer sized beforehand
+class Writer {
+public:
+    explicit Writer(uint8_t* data) noexcept : data(data) {}
+    template <class T>
+    void write(std::size_t offset, const T& value) noexcept
+    {
+        std::memcpy(data + offset, &value, sizeof(T));
+    }
+    uint32_t writeString(std::size_t offset, const std::string& string) noexcept
+    {
+        write(offset, static_cast<uint32_t>(string.size()));
+        std::memcpy(data + offset + sizeof(uint32_t), string.data(), string.size());
+        return static_cast<uint32_t>(offset);
+    }
+    static std::size_t stringSize(const std::string& string) noexcept
+    {
+        return sizeof(uint32_t) + string.size() + 1;
+    }
+    void writeNotes(std::size_t offset, const Sequence& sequence) noexcept
+    {
+        const std::size_t count = sequence.size();
+        auto onTicks = data + offset;
+        auto offTicks = onTicks + count * sizeof(int64_t);
+        auto velocities = offTicks + count * sizeof(int64_t);
+        auto numbers = velocities + count * sizeof(float);
+        for (std::size_t i = 0; i < count; ++i) {
+            const auto& note = sequence[i];
+            const int64_t on = quartersToTicks(note.timestamp);
+            const int64_t off = quartersToTicks(note.timestamp + note.duration);
+            const float velocity = clamp(note.velocity, 0.0f, 1.0f);
+            std::memcpy(onTicks + i * sizeof(int64_t), &on, sizeof(int64_t));
+            std::memcpy(offTicks + i * sizeof(int64_t), &off, sizeof(int64_t));
+            std::memcpy(velocities + i * sizeof(float), &velocity, sizeof(float));
+            numbers[i] = note.number;
+        }
+    }
+private:
+    uint8_t* data;
+};
+
+}
+
+std::shared_ptr<const BeatStorage> mapBeatFile(const fs::path& file, std::error_code& error)
+{
+#if defined _WIN32
+    HANDLE handle = CreateFileW(file.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        error = std::error_code(static_cast<int>(GetLastError()), std::system_category());
+        return {};
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+        error = BeatDescriptionError::InvalidBinaryFile;
+        CloseHandle(handle);
+        return {};
+    }
+
+    HANDLE mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        error = std::error_code(static_cast<int>(GetLastError()), std::system_category());
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(handle);
+        return {};
+    }
+
+    return std::make_shared<MappedFile>(handle, mapping, view, static_cast<std::size_t>(size.QuadPart));
+#else
+    const int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = std::error_code(errno, std::generic_category());
+        return {};
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        error = BeatDescriptionError::InvalidBinaryFile;
+        close(fd);
+        return {};
+    }
+
+    const auto size = static_cast<std::size_t>(info.st_size);
+    void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) {
+        error = std::error_code(errno, std::generic_category());
+        return {};
+    }
+
+    return std::make_shared<MappedFile>(view, size);
+#endif
+}
+
+std::shared_ptr<const BeatStorage> copyBeatData(const void* data, std::size_t size)
+{
+    auto storage = std::make_shared<MemoryStorage>(size);
+    if (size > 0)
+        std::memcpy(storage->data(), data, size);
+
+    return storage;
+}
+
+bool isBinaryBeat(const uint8_t* data, std::size_t size) noexcept
+{
+    return size >= sizeof(binary::magic)
+        && std::memcmp(data, binary::magic, sizeof(binary::magic)) == 0;
+}
+
+std::shared_ptr<const BeatStorage> encodeBinaryBeat(const BeatDescription& beat)
+{
+    // Gather the sequences in file order; the fills of a part follow its main loop
+    std::vector<const Sequence*> sequences;
+    binary::Header header {};
+    std::memcpy(header.magic, binary::magic, sizeof(binary::magic));
+    header.version = binary::version;
+    header.byteOrder = binary::byteOrderMark;
+    header.intro = binary::noSequence;
+    header.ending = binary::noSequence;
+
+    if (beat.intro) {
+        header.intro = static_cast<uint32_t>(sequences.size());
+        sequences.push_back(&*beat.intro);
+    }
+
+    if (beat.ending) {
+        header.ending = static_cast<uint32_t>(sequences.size());
+        sequences.push_back(&*beat.ending);
+    }
+
+    std::vector<binary::PartEntry> parts;
+    for (const auto& part : beat.parts) {
+        binary::PartEntry entry {};
+        entry.mainLoop = static_cast<uint32_t>(sequences.size());
+        sequences.push_back(&part.mainLoop);
+        entry.firstFill = static_cast<uint32_t>(sequences.size());
+        entry.numFills = static_cast<uint32_t>(part.fills.size());
+        for (const auto& fill : part.fills)
+            sequences.push_back(&fill);
+
+        entry.transition = binary::noSequence;
+        if (part.transition) {
+            entry.transition = static_cast<uint32_t>(sequences.size());
+            sequences.push_back(&*part.transition);
+        }
+        parts.push_back(entry);
+    }
+
+    header.numSequences = static_cast<uint32_t>(sequences.size());
+    header.numParts = static_cast<uint32_t>(parts.size());
+    header.signatureNum = beat.signature.num;
+    header.signatureDenom = beat.signature.denom;
+    header.bpm = beat.bpm;
+    header.quartersPerBar = beat.quartersPerBar;
+    header.barTicks = quartersToTicks(beat.quartersPerBar);
+
+    // Lay out the file
+    std::size_t offset = sizeof(header);
+    header.sequenceTable = offset;
+    offset += sequences.size() * sizeof(binary::SequenceEntry);
+    header.partTable = offset;
+    offset += parts.size() * sizeof(binary::PartEntry);
+
+    const std::size_t strings = offset;
+    offset += Writer::stringSize(beat.name) + Writer::stringSize(beat.group);
+    for (const auto& part : beat.parts)
+        offset += Writer::stringSize(part.name);
+
+    // Identical sequences, such as a file used both as a fill and a
+    // transition, share their notes
+    std::vector<binary::SequenceEntry> entries;
+    std::vector<bool> written;
+    std::unordered_multimap<uint64_t, std::size_t> contents;
+    for (const auto* sequence : sequences) {
+        const auto hash = hashSequence(*sequence);
+        const auto range = contents.equal_range(hash);
+        const auto same = std::find_if(range.first, range.second, [&](const std::pair<const uint64_t, std::size_t>& content) {
+            return sameNotes(*sequences[content.second], *sequence);
+        });
+        if (same != range.second) {
+            entries.push_back(entries[same->second]);
+            written.push_back(false);
+            continue;
+        }
+
+        offset = binary::align8(offset);
+        binary::SequenceEntry entry {};
+        entry.notes = offset;
+        entry.count = static_cast<uint32_t>(sequence->size());
+        // Notes all on the first beat still make a bar, which the player can loop
+        const double numBars = std::max(1.0, barCount(*sequence, beat.quartersPerBar));
+        entry.durationTicks = quartersToTicks(numBars * beat.quartersPerBar);
+        contents.emplace(hash, entries.size());
+        entries.push_back(entry);
+        written.push_back(true);
+        offset += sequence->size() * bytesPerNote;
+    }
+    header.fileSize = binary::align8(offset);
+
+    // Fill it
+    auto storage = std::make_shared<MemoryStorage>(static_cast<std::size_t>(header.fileSize));
+    Writer writer { storage->data() };
+    offset = strings;
+    header.name = writer.writeString(offset, beat.name);
+    offset += Writer::stringSize(beat.name);
+    header.group = writer.writeString(offset, beat.group);
+    offset += Writer::stringSize(beat.group);
+    for (std::size_t i = 0; i < parts.size(); ++i) {
+        parts[i].name = writer.writeString(offset, beat.parts[i].name);
+        offset += Writer::stringSize(beat.parts[i].name);
+    }
+
+    writer.write(0, header);
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        writer.write(header.sequenceTable + i * sizeof(binary::SequenceEntry), entries[i]);
+        if (written[i])
+            writer.writeNotes(entries[i].notes, *sequences[i]);
+    }
+    for (std::size_t i = 0; i < parts.size(); ++i)
+        writer.write(header.partTable + i * sizeof(binary::PartEntry), parts[i]);
+
+    return storage;
+}
+
+bool bindBinaryBeat(BeatDescription& beat, std::shared_ptr<const BeatStorage> storage, std::error_code& error)
+{
+    binary::Header header;
+    if (!storage || !isBinaryBeat(storage->data(), storage->size()) || !readAt(*storage, 0, header)) {
+        error = BeatDescriptionError::InvalidBinaryFile;
+        return false;
+    }
+
+    if (header.version != binary::version || header.byteOrder != binary::byteOrderMark) {
+        error = BeatDescriptionError::UnsupportedBinaryVersion;
+        return false;
+    }
+
+    // The bytes may come from anywhere, so the header is checked before it
+    // sizes anything: every part has at least a main loop in the sequence table
+    error = BeatDescriptionError::InvalidBinaryFile;
+    if (header.fileSize > storage->size() || header.numParts == 0
+        || header.numParts > header.numSequences || header.partTable > storage->size()
+        || (storage->size() - header.partTable) / sizeof(binary::PartEntry) < header.numParts
+        || !isPositiveNormal(header.quartersPerBar) || header.barTicks <= 0
+        || !isPositiveNormal(header.bpm) || header.bpm > std::numeric_limits<float>::max()
+        || header.signatureDenom == 0)
+        return false;
+
+    BeatPlayback playback;
+    playback.barTicks = header.barTicks;
+    if (!readOptionalSequence(*storage, header, header.intro, playback.intro)
+        || !readOptionalSequence(*storage, header, header.ending, playback.ending))
+        return false;
+
+    std::vector<std::string> partNames (header.numParts);
+    for (uint32_t i = 0; i < header.numParts; ++i) {
+        binary::PartEntry entry;
+        if (!readAt(*storage, header.partTable + i * sizeof(entry), entry)
+            || !readString(*storage, entry.name, partNames[i]))
+            return false;
+
+        PartPlayback part;
+        if (!readSequence(*storage, header, entry.mainLoop, part.mainLoop)
+            || !readOptionalSequence(*storage, header, entry.transition, part.transition))
+            return false;
+
+        if (uint64_t { entry.firstFill } + entry.numFills > header.numSequences)
+            return false;
+
+        part.fills.resize(entry.numFills);
+        for (uint32_t j = 0; j < entry.numFills; ++j) {
+            if (!readSequence(*storage, header, entry.firstFill + j, part.fills[j]))
+                return false;
+        }
+        playback.parts.push_back(std::move(part));
+    }
+
+    std::string name;
+    std::string group;
+    if (!readString(*storage, header.name, name) || !readString(*storage, header.group, group))
+        return false;
+
+    error.clear();
+    beat.name = std::move(name);
+    beat.group = std::move(group);
+    beat.bpm = static_cast<float>(header.bpm);
+    beat.quartersPerBar = header.quartersPerBar;
+    beat.signature = { header.signatureNum, header.signatureDenom };
+    beat.parts.resize(header.numParts);
+    for (uint32_t i = 0; i < header.numParts; ++i)
+        beat.parts[i].name = std::move(partNames[i]);
+    beat.playback = std::move(playback);
+    beat.storage = std::move(storage);
+    return true;
+}
+
+}
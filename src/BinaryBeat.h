@@ -0,0 +1,135 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <vector>
+#include "filesystem.hpp"
+
+namespace fs = ghc::filesystem;
+
+namespace batteur {
+
+struct BeatDescription;
+
+/**
+ * @brief The compiled, binary form of a beat (`.btb` files).
+ *
+ * All values are stored in the byte order of the machine that wrote the file,
+ * which is checked on load. Offsets are in bytes from the start of the file.
+ *
+ *   Header            see below
+ *   Sequence table    SequenceEntry[numSequences]
+ *   Part table        PartEntry[numParts]; the fills of a part are
+ *                     consecutive entries of the sequence table
+ *   Strings           uint32 length, then the bytes and a terminating 0
+ *   Notes             for each sequence, 8-byte aligned:
+ *                     int64 onTicks[count], int64 offTicks[count],
+ *                     float velocities[count], uint8 numbers[count]
+ *
+ * The note arrays are used in place by the player, so that a file mapped in
+ * memory needs no parsing nor copying beyond the header and the tables.
+ */
+namespace binary {
+
+constexpr char magic[4] { 'B', 'T', 'B', '\0' };
+constexpr uint32_t version { 1 };
+constexpr uint32_t byteOrderMark { 0x01020304 };
+constexpr uint32_t noSequence { 0xFFFFFFFF };
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t numSequences;
+    uint32_t numParts;
+    uint32_t intro; // Sequence index, or noSequence
+    uint32_t ending;
+    uint32_t name; // Offset of the string
+    uint32_t group;
+    int32_t signatureNum;
+    int32_t signatureDenom;
+    uint32_t reserved;
+    double bpm;
+    double quartersPerBar;
+    int64_t barTicks;
+    uint64_t sequenceTable;
+    uint64_t partTable;
+    uint64_t fileSize;
+};
+
+struct SequenceEntry {
+    uint64_t notes; // Offset of the note arrays
+    uint32_t count;
+    uint32_t reserved;
+    int64_t durationTicks;
+};
+
+struct PartEntry {
+    uint32_t name;
+    uint32_t mainLoop;
+    uint32_t transition; // Sequence index, or noSequence
+    uint32_t firstFill;
+    uint32_t numFills;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(Header) == 96, "Unexpected padding in the binary header");
+static_assert(sizeof(SequenceEntry) == 24, "Unexpected padding in the sequence table");
+static_assert(sizeof(PartEntry) == 24, "Unexpected padding in the part table");
+
+// Round an offset up to the alignment of the note arrays
+constexpr std::size_t align8(std::size_t offset) noexcept
+{
+    return (offset + 7) & ~static_cast<std::size_t>(7);
+}
+
+}
+
+/**
+ * @brief Bytes holding a binary beat, either mapped from a file or in memory.
+ * The data is aligned to at least 8 bytes.
+ */
+class BeatStorage {
+public:
+    virtual ~BeatStorage() = default;
+    virtual const uint8_t* data() const noexcept = 0;
+    virtual std::size_t size() const noexcept = 0;
+};
+
+/**
+ * @brief Map a file in memory, read-only. The file should not be rewritten in
+ * place while the mapping is alive; replace it with a new file instead.
+ *
+ * @return null if the file could not be opened or mapped
+ */
+std::shared_ptr<const BeatStorage> mapBeatFile(const fs::path& file, std::error_code& error);
+
+/**
+ * @brief Copy the bytes of a binary beat, for instance kept by a host, to an
+ * aligned storage
+ */
+std::shared_ptr<const BeatStorage> copyBeatData(const void* data, std::size_t size);
+
+/**
+ * @brief Check if some bytes start like a binary beat
+ */
+bool isBinaryBeat(const uint8_t* data, std::size_t size) noexcept;
+
+/**
+ * @brief Compile the note lists and the metadata of a beat to the binary form.
+ * Identical sequences of the beat share their notes in the storage.
+ */
+std::shared_ptr<const BeatStorage> encodeBinaryBeat(const BeatDescription& beat);
+
+/**
+ * @brief Read the metadata of a binary beat into `beat`, and point its
+ * playback sequences into the storage, which the beat keeps alive. The note
+ * lists of the description (`intro`, `Part::mainLoop`...) are left untouched.
+ * The storage may come from anywhere: the tables, the tempo and the note
+ * timings are checked before the player can use them.
+ *
+ * @return false if the storage does not hold a valid binary beat
+ */
+bool bindBinaryBeat(BeatDescription& beat, std::shared_ptr<const BeatStorage> storage, std::error_code& error);
+
+}
@@ -1,14 +1,25 @@
 #include "FileReadingHelpers.h"
+#include "BinaryBeat.h"
 #include "MathHelpers.h"
 #include "MidiHelpers.h"
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <thread>
 
 tl::optional<double> getQuarterPerBars(const fmidi_event_t& evt)
 {
     if (evt.data[0] != 0x58)
         return {};
 
-    return static_cast<double>(evt.data[1]) / static_cast<double>(1 << (evt.data[2] - 2));
+    if (evt.datalen < 3)
+        return {};
+
+    return std::ldexp(static_cast<double>(evt.data[1]), 2 - static_cast<int>(evt.data[2]));
 }
 
 tl::optional<double> getSecondsPerQuarter(const fmidi_event_t& evt)
@@ -21,11 +32,120 @@ tl::optional<double> getSecondsPerQuarter(const fmidi_event_t& evt)
     return 1e-6 * tempo;
 }
 
+namespace {
+
+struct TrackEvent {
+    uint64_t ticks;
+    const fmidi_event_t* event;
+};
+
+/**
+ * @brief The note, tempo and time signature events of all the tracks of a
+ * file, in time order. At equal times, the events of the first tracks come
+ * first, as with fmidi_seq.
+ */
+std::vector<TrackEvent> mergeTracks(const fmidi_smf_t& smf)
+{
+    std::vector<TrackEvent> events;
+    const auto info = fmidi_smf_get_info(&smf);
+    for (uint16_t track = 0; track < info->track_count; ++track) {
+        fmidi_track_iter_t iterator;
+        fmidi_smf_track_begin(&iterator, track);
+        uint64_t ticks { 0 };
+        while (const auto evt = fmidi_smf_track_next(&smf, &iterator)) {
+            ticks += evt->delta;
+            if (evt->type == fmidi_event_meta) {
+                if (evt->data[0] == 0x2f || evt->data[0] == 0x3f) // End of track
+                    break;
+
+                if (evt->data[0] != 0x51 && evt->data[0] != 0x58)
+                    continue;
+            } else if (evt->type == fmidi_event_message) {
+                const auto status = midi::status(evt->data[0]);
+                if ((status != midi::noteOn && status != midi::noteOff) || evt->datalen < 3)
+                    continue;
+            } else {
+                continue;
+            }
+
+            events.push_back({ ticks, evt });
+        }
+    }
+
+    const auto earlier = [](const TrackEvent& lhs, const TrackEvent& rhs) {
+        return lhs.ticks < rhs.ticks;
+    };
+    if (!std::is_sorted(events.begin(), events.end(), earlier))
+        std::stable_sort(events.begin(), events.end(), earlier);
+
+    return events;
+}
+
+struct TimeSignatureChange {
+    double time;
+    double barLength;
+};
+
+/**
+ * @brief Position of the start of a bar, counting from 0. A time signature
+ * change applies from the first bar line at or after it, so a change in the
+ * middle of a bar does not cut it short.
+ */
+double barPosition(unsigned bar, const std::vector<TimeSignatureChange>& changes, double unitsPerQuarter)
+{
+    // Changes closer than this to a bar line are on it, for SMPTE times
+    const double tolerance { 1e-6 * unitsPerQuarter };
+    double position { 0.0 };
+    double barLength { 4 * unitsPerQuarter };
+    std::size_t next { 0 };
+    for (unsigned i = 0;; ++i) {
+        while (next < changes.size() && changes[next].time <= position + tolerance) {
+            if (changes[next].barLength > 0.0)
+                barLength = changes[next].barLength;
+            ++next;
+        }
+
+        if (i == bar)
+            return position;
+
+        position += barLength;
+    }
+}
+
+// SMPTE divisions hold minus the frames per second and the ticks per frame
+double smpteSeconds(uint64_t ticks, uint16_t division)
+{
+    const auto framesPerSecond = -static_cast<int8_t>(division >> 8);
+    const double fps = (framesPerSecond == 29) ? 30000.0 / 1001.0 : framesPerSecond;
+    return static_cast<double>(ticks) / (fps * (division & 0xff));
+}
+
+}
+
+FileStamp readStamp(const fs::path& file, std::error_code& ec)
+{
+    FileStamp stamp {};
+    stamp.size = fs::file_size(file, ec);
+    if (!ec)
+        stamp.modified = fs::last_write_time(file, ec);
+
+    return stamp;
+}
+
 tl::expected<batteur::Sequence, ReadingError> readSequenceFromFile(const nlohmann::json& json, const fs::path& rootDirectory)
 {
-    fs::path filepath = rootDirectory / json["filename"].get<std::string>();
+    const auto filename = json.find("filename");
+    if (filename == json.end() || !filename->is_string())
+        return tl::make_unexpected(ReadingError::NoFilename);
+
+    fs::path filepath = rootDirectory / filename->get<std::string>();
+
+    // The events are copied out by fmidi, so the mapping is only needed here
+    std::error_code ec;
+    fmidi_smf_u midiFile;
+    if (const auto storage = batteur::mapBeatFile(filepath, ec))
+        midiFile.reset(fmidi_smf_mem_read(storage->data(), storage->size()));
 
-    fmidi_smf_u midiFile { fmidi_smf_file_read(filepath.c_str()) };
     if (!midiFile) {
         return tl::make_unexpected(ReadingError::MidiFileError);
     }
@@ -46,73 +166,91 @@ tl::expected<batteur::Sequence, ReadingError> readSequenceFromFile(const nlohman
     // Zero has a meaning internally
     const unsigned bars { b == json.end() ? 0 : b->get<unsigned>() };
 
-    const auto updateIgnored = [ignoreBars] (unsigned qpb) -> double {
-        return static_cast<double>(qpb * ignoreBars);
-    };
+    // Notes still sounding, as a stack per note number threaded through
+    // `below`: a note-off ends the latest note-on of its number that is not
+    // ended yet, so that overlapping hits of the same note pair up
+    constexpr std::size_t noNote { static_cast<std::size_t>(-1) };
+    std::array<std::size_t, 128> openNotes;
+    openNotes.fill(noNote);
+    std::vector<std::size_t> below;
+
+    // With a metrical division, times are kept in ticks until the end, so
+    // that the timestamps and durations only get rounded once. With an SMPTE
+    // division, they are in quarters, following the tempo map.
+    const auto info = fmidi_smf_get_info(midiFile.get());
+    const bool smpte { (info->delta_unit & 0x8000) != 0 };
+    const double unitsPerQuarter { smpte ? 1.0 : static_cast<double>(info->delta_unit) };
+
+    const auto events = mergeTracks(*midiFile);
+    std::vector<double> times;
+    std::vector<TimeSignatureChange> signatures;
+    times.reserve(events.size());
+    double secondsPerQuarter { 0.5 };
+    double tempoSeconds { 0.0 };
+    double tempoQuarters { 0.0 };
+    for (const auto& event : events) {
+        double time { static_cast<double>(event.ticks) };
+        if (smpte) {
+            const double seconds = smpteSeconds(event.ticks, info->delta_unit);
+            time = tempoQuarters + (seconds - tempoSeconds) / secondsPerQuarter;
+            if (auto spq = getSecondsPerQuarter(*event.event)) {
+                tempoSeconds = seconds;
+                tempoQuarters = time;
+                secondsPerQuarter = *spq;
+            }
+        }
 
-    const auto updateEnd = [ignoreBars, bars] (unsigned qpb) -> double {
-        if (bars > 0)
-            return static_cast<double>(qpb *(ignoreBars + bars));
-        else
-            return 0.0;
-    };
+        if (auto qpb = getQuarterPerBars(*event.event))
+            signatures.push_back({ time, *qpb * unitsPerQuarter });
 
-    const auto findLastNoteOn = [&returned](uint8_t number, double time) -> void {
-        for (auto it = returned.rbegin(); it != returned.rend(); ++it) {
-            if (it->number == number) {
-                it->duration = max(0.0, time - it->timestamp);
-                return;
-            }
+        times.push_back(time);
+    }
+
+    const double windowStart = barPosition(ignoreBars, signatures, unitsPerQuarter);
+    const double windowEnd = bars > 0 ? barPosition(ignoreBars + bars, signatures, unitsPerQuarter) : 0.0;
+
+    const auto noteOn = [&](uint8_t number, double time, float velocity) -> void {
+        returned.push_back({ time, 0.0, number, velocity });
+        if (number < openNotes.size()) {
+            below.push_back(openNotes[number]);
+            openNotes[number] = returned.size() - 1;
         }
     };
 
-    fmidi_seq_u midiSequencer { fmidi_seq_new(midiFile.get()) };
-    fmidi_seq_event_t event;
-    unsigned quarterPerBars { 4 };
-    double secondsPerQuarter { 0.5 };
-    auto ignoredQuarters = updateIgnored(quarterPerBars);
-    auto fileEnd = updateEnd(quarterPerBars);
-    while (fmidi_seq_next_event(midiSequencer.get(), &event)) {
-        const auto& evt = event.event;
-        switch (evt->type) {
-        case (fmidi_event_meta):
-            if (auto qpb = getQuarterPerBars(*evt)) {
-                quarterPerBars = *qpb;
-                ignoredQuarters = updateIgnored(quarterPerBars);
-                fileEnd = updateEnd(quarterPerBars);
-            } else if (auto spq = getSecondsPerQuarter(*evt)) {
-                secondsPerQuarter = *spq;
-            }
-            break;
-        case (fmidi_event_message):
-            // go to the next process step
-            break;
-        default:
-            // Ignore other messages
-            continue;
-        }
+    const auto noteOff = [&](uint8_t number, double time) -> void {
+        if (number >= openNotes.size() || openNotes[number] == noNote)
+            return;
+
+        const auto index = openNotes[number];
+        openNotes[number] = below[index];
+        returned[index].duration = max(0.0, time - returned[index].timestamp);
+    };
 
-        const double timeInQuarters = event.time / secondsPerQuarter;
-        
-        if (timeInQuarters < ignoredQuarters)
+    for (std::size_t i = 0; i < events.size(); ++i) {
+        const auto& evt = events[i].event;
+        const double time = times[i];
+        if (time < windowStart)
             continue;
 
-        if (fileEnd > 0.0 && timeInQuarters > fileEnd)
+        if (bars > 0 && time > windowEnd)
             break;
 
+        if (evt->type != fmidi_event_message)
+            continue;
+
         switch (midi::status(evt->data[0])) {
         case midi::noteOff:
-            findLastNoteOn(evt->data[1], timeInQuarters);
+            noteOff(evt->data[1], time);
             break;
         case midi::noteOn:
             // It's a note-off
             if (evt->data[2] == 0) {
-                findLastNoteOn(evt->data[1], timeInQuarters);
+                noteOff(evt->data[1], time);
                 break;
             }
 
             // It's a real note-on
-            returned.push_back({ timeInQuarters, 0.0, evt->data[1], ((float)evt->data[2]) / 127.0f });
+            noteOn(evt->data[1], time, ((float)evt->data[2]) / 127.0f);
             break;
         default:
             break;
@@ -123,7 +261,8 @@ tl::expected<batteur::Sequence, ReadingError> readSequenceFromFile(const nlohman
         return tl::make_unexpected(ReadingError::NoDataRead);
 
     for (auto& note : returned) {
-        note.timestamp -= ignoredQuarters;
+        note.timestamp = (note.timestamp - windowStart) / unitsPerQuarter;
+        note.duration /= unitsPerQuarter;
     }
 
 #if 0
@@ -198,6 +337,75 @@ tl::expected<batteur::Sequence, ReadingError> readSequence(const nlohmann::json&
         return tl::make_unexpected(ReadingError::NotPresent);    
 }
 
+std::vector<tl::expected<batteur::Sequence, ReadingError>> readSequences(const std::vector<nlohmann::json>& jsons, const fs::path& rootDirectory)
+{
+    std::vector<tl::expected<batteur::Sequence, ReadingError>> returned(
+        jsons.size(), tl::make_unexpected(ReadingError::NotPresent));
+
+    // Identical descriptions are only read once
+    std::vector<std::size_t> unique;
+    std::vector<std::size_t> sameAs(jsons.size());
+    std::map<std::string, std::size_t> firstIndex;
+    for (std::size_t i = 0; i < jsons.size(); ++i) {
+        const auto inserted = firstIndex.emplace(jsons[i].dump(), i);
+        sameAs[i] = inserted.first->second;
+        if (inserted.second)
+            unique.push_back(i);
+    }
+
+    const auto copyDuplicates = [&]() {
+        for (std::size_t i = 0; i < jsons.size(); ++i) {
+            if (sameAs[i] != i)
+                returned[i] = returned[sameAs[i]];
+        }
+    };
+
+    const auto hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    const auto numThreads = static_cast<unsigned>(
+        std::min<std::size_t>(unique.size(), std::min(hardwareThreads, maxReadingThreads)));
+
+    if (numThreads <= 1) {
+        for (auto i : unique)
+            returned[i] = readSequence(jsons[i], rootDirectory);
+
+        copyDuplicates();
+        return returned;
+    }
+
+    // Each thread takes the next description until there are none left; the
+    // first exception is rethrown once all threads are done.
+    std::atomic<std::size_t> next { 0 };
+    std::exception_ptr exception;
+    std::mutex exceptionMutex;
+    const auto work = [&]() {
+        for (auto u = next++; u < unique.size(); u = next++) {
+            const auto i = unique[u];
+            try {
+                returned[i] = readSequence(jsons[i], rootDirectory);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock { exceptionMutex };
+                if (!exception)
+                    exception = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+    for (unsigned t = 1; t < numThreads; ++t)
+        threads.emplace_back(work);
+
+    work();
+    for (auto& thread : threads)
+        thread.join();
+
+    if (exception)
+        std::rethrow_exception(exception);
+
+    copyDuplicates();
+    return returned;
+}
+
 tl::expected<batteur::Sequence, ReadingError> readSequenceByName(const nlohmann::json& json, const fs::path& rootDirectory, const std::string& name)
 {
     if (json.is_null())
@@ -33,12 +33,27 @@ enum class QuartersPerBarError {
     Zero
 };
 
+constexpr unsigned maxReadingThreads { 8 };
+
+// Size and modification time of a file, to tell whether it changed
+struct FileStamp {
+    uintmax_t size;
+    fs::file_time_type modified;
+    bool operator==(const FileStamp& other) const { return size == other.size && modified == other.modified; }
+    bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
 // Helper functions
 
 tl::expected<batteur::Sequence, ReadingError> readSequenceByName(const nlohmann::json& json, const fs::path& rootDirectory, const std::string& name = "");
 tl::expected<batteur::Sequence, ReadingError> readSequence(const nlohmann::json& json, const fs::path& rootDirectory);
+// Read several sequences at once, on as many threads as there are cores (up to maxReadingThreads).
+// Identical descriptions are read once, and the results are in the order of the descriptions.
+std::vector<tl::expected<batteur::Sequence, ReadingError>> readSequences(const std::vector<nlohmann::json>& jsons, const fs::path& rootDirectory);
 tl::expected<double, BPMError> checkBPM(const nlohmann::json& bpm);
 tl::expected<double, QuartersPerBarError> checkQuartersPerBar(const nlohmann::json& qpb);
 
+FileStamp readStamp(const fs::path& file, std::error_code& ec);
+
 tl::optional<double> getQuarterPerBars(const fmidi_event_t& evt);
 tl::optional<double> getSecondsPerQuarter(const fmidi_event_t& evt);
\ No newline at end of file
@@ -0,0 +1,821 @@
+#include "JsonBeatReader.h"
+#include "BeatLibrary.h"
+#include "FileReadingHelpers.h"
+#include <algorithm>
+
+using nlohmann::json;
+
+namespace batteur {
+
+namespace {
+
+using SequenceResult = tl::expected<Sequence, ReadingError>;
+
+constexpr std::size_t noFile { static_cast<std::size_t>(-1) };
+
+/**
+ * @brief A sequence as read from the text. Sequences from MIDI files are only
+ * decoded once the whole description is read, all together; until then they
+ * are an index in the list of file references.
+ */
+struct PendingSequence {
+    PendingSequence() = default;
+    explicit PendingSequence(SequenceResult&& result) : result(std::move(result)) {}
+    explicit PendingSequence(std::size_t file) : file(file) {}
+    SequenceResult result { tl::make_unexpected(ReadingError::NotPresent) };
+    std::size_t file { noFile };
+};
+
+struct PendingPart {
+    std::string name;
+    PendingSequence mainLoop;
+    std::vector<PendingSequence> fills;
+    PendingSequence transition;
+};
+
+/**
+ * @brief SAX handler for beat descriptions.
+ *
+ * The handler keeps a stack of the containers it is in, and decides what a
+ * value means from the innermost container and the last key read. Anything it
+ * does not know about is skipped, however deeply nested. Since sequences and
+ * parts do not nest, the part and the sequence being read are plain members.
+ *
+ * The MIDI files referenced by the description are decoded in parallel by
+ * `finish`, and the parts are then assembled in the order of the text.
+ *
+ * When only reading the metadata, the elements of note lists are counted
+ * without being read, and MIDI files are only checked for existence.
+ */
+class BeatSaxHandler : public nlohmann::json_sax<json> {
+public:
+    explicit BeatSaxHandler(const fs::path& rootDirectory, bool metadataOnly = false)
+    : rootDirectory(rootDirectory), metadataOnly(metadataOnly)
+    {
+        stack.reserve(8);
+    }
+
+    std::unique_ptr<BeatDescription> finish(std::error_code& error);
+    bool finishMetadata(BeatInfo& info, std::error_code& error);
+
+    bool null() final { return scalar(Value(Value::Null)); }
+    bool boolean(bool val) final
+    {
+        Value value(Value::Bool);
+        value.integer = val;
+        return scalar(value);
+    }
+    bool number_integer(number_integer_t val) final
+    {
+        Value value(Value::Integer);
+        value.integer = val;
+        return scalar(value);
+    }
+    bool number_unsigned(number_unsigned_t val) final
+    {
+        Value value(Value::Unsigned);
+        value.integer = static_cast<int64_t>(val);
+        value.unsignedInteger = val;
+        return scalar(value);
+    }
+    bool number_float(number_float_t val, const string_t&) final
+    {
+        Value value(Value::Float);
+        value.real = val;
+        return scalar(value);
+    }
+    bool string(string_t& val) final
+    {
+        Value value(Value::String);
+        value.string = &val;
+        return scalar(value);
+    }
+    bool start_object(std::size_t) final { return open(true); }
+    bool start_array(std::size_t) final { return open(false); }
+    bool key(string_t& val) final
+    {
+        currentKey = std::move(val);
+        return true;
+    }
+    bool end_object() final { return close(); }
+    bool end_array() final { return close(); }
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) final
+    {
+        return false;
+    }
+
+private:
+    struct Value {
+        enum Type { Null, Bool, Integer, Unsigned, Float, String };
+        explicit Value(Type type) : type(type) {}
+        Type type;
+        int64_t integer { 0 };
+        uint64_t unsignedInteger { 0 };
+        double real { 0.0 };
+        std::string* string { nullptr };
+        json toJson() const;
+    };
+
+    // What a value stands for
+    enum class Slot {
+        Skip,
+        Name,
+        Group,
+        Bpm,
+        QuartersPerBar,
+        Signature,
+        SignatureValue,
+        Intro,
+        Ending,
+        Parts,
+        Part,
+        PartName,
+        MainLoop,
+        Fills,
+        Fill,
+        Transition,
+        SequenceField,
+        Notes,
+        Note,
+        NoteTime,
+        NoteDuration,
+        NoteNumber,
+        NoteVelocity,
+    };
+
+    enum class Container { Root, Skip, Signature, Parts, Part, Fills, Sequence, Notes, Note };
+
+    struct NoteField {
+        enum Kind { Missing, Integer, Float, Other } kind { Missing };
+        int64_t integer { 0 };
+        double real { 0.0 };
+    };
+
+    Slot nextSlot();
+    bool scalar(const Value& value);
+    bool open(bool isObject);
+    bool close();
+    void setSequence(Slot slot, PendingSequence&& sequence);
+    void setNoteField(Slot slot, const Value* value);
+    void finishNote();
+    PendingSequence finishSequence();
+    SequenceResult resolve(PendingSequence& sequence, std::vector<SequenceResult>& files);
+    void startPart();
+    void finishPart();
+    template <class Beat>
+    bool finishHeader(Beat& beat, std::error_code& error);
+
+    const fs::path& rootDirectory;
+    const bool metadataOnly;
+    std::vector<Container> stack;
+    std::string currentKey;
+    unsigned signatureIndex { 0 };
+
+    // Root values
+    bool rootIsObject { false };
+    tl::optional<std::string> name;
+    std::string group;
+    tl::optional<double> bpm;
+    tl::optional<json> quartersPerBar;
+    bool signatureIsArray { false };
+    unsigned signatureSize { 0 };
+    tl::optional<int> signatureNum;
+    tl::optional<int> signatureDenom;
+    PendingSequence intro;
+    PendingSequence ending;
+    bool partsIsArray { false };
+    unsigned partsSize { 0 };
+    std::vector<PendingPart> parts;
+    std::vector<json> fileReferences;
+
+    // The part being read
+    PendingPart part;
+
+    // The sequence being read
+    Slot sequenceSlot { Slot::Skip };
+    json fileFields;
+    bool hasFilename { false };
+    bool hasNotes { false };
+    tl::optional<ReadingError> notesError;
+    Sequence notes; // Reused across sequences, so that it rarely grows
+    std::size_t numNotes { 0 }; // Elements of the note list, when only reading the metadata
+
+    // The note being read
+    NoteField time;
+    NoteField duration;
+    NoteField number;
+    NoteField velocity;
+};
+
+json BeatSaxHandler::Value::toJson() const
+{
+    switch (type) {
+    case Null: return json(nullptr);
+    case Bool: return json(integer != 0);
+    case Integer: return json(integer);
+    case Unsigned: return json(unsignedInteger);
+    case Float: return json(real);
+    case String: return json(*string);
+    }
+    return json(nullptr);
+}
+
+BeatSaxHandler::Slot BeatSaxHandler::nextSlot()
+{
+    if (stack.empty())
+        return Slot::Skip;
+
+    switch (stack.back()) {
+    case Container::Root:
+        if (currentKey == "name") return Slot::Name;
+        if (currentKey == "group") return Slot::Group;
+        if (currentKey == "bpm") return Slot::Bpm;
+        if (currentKey == "quarters_per_bar") return Slot::QuartersPerBar;
+        if (currentKey == "signature") return Slot::Signature;
+        if (currentKey == "intro") return Slot::Intro;
+        if (currentKey == "ending") return Slot::Ending;
+        if (currentKey == "parts") return Slot::Parts;
+        return Slot::Skip;
+    case Container::Signature:
+        return Slot::SignatureValue;
+    case Container::Parts:
+        return Slot::Part;
+    case Container::Part:
+        if (currentKey == "name") return Slot::PartName;
+        if (currentKey == "sequence") return Slot::MainLoop;
+        if (currentKey == "fills") return Slot::Fills;
+        if (currentKey == "transition") return Slot::Transition;
+        return Slot::Skip;
+    case Container::Fills:
+        return Slot::Fill;
+    case Container::Sequence:
+        if (currentKey == "filename" || currentKey == "ignore_bars" || currentKey == "bars")
+            return Slot::SequenceField;
+        if (currentKey == "notes") return Slot::Notes;
+        return Slot::Skip;
+    case Container::Notes:
+        return Slot::Note;
+    case Container::Note:
+        if (currentKey == "time") return Slot::NoteTime;
+        if (currentKey == "duration") return Slot::NoteDuration;
+        if (currentKey == "number") return Slot::NoteNumber;
+        if (currentKey == "velocity") return Slot::NoteVelocity;
+        return Slot::Skip;
+    case Container::Skip:
+        return Slot::Skip;
+    }
+    return Slot::Skip;
+}
+
+bool BeatSaxHandler::scalar(const Value& value)
+{
+    const auto slot = nextSlot();
+    switch (slot) {
+    case Slot::Name:
+        if (value.type == Value::String)
+            name = *value.string;
+        else
+            name.reset();
+        break;
+    case Slot::Group:
+        if (value.type == Value::String)
+            group = *value.string;
+        break;
+    case Slot::Bpm:
+        if (value.type == Value::Integer || value.type == Value::Unsigned)
+            bpm = static_cast<double>(value.integer);
+        else if (value.type == Value::Float)
+            bpm = value.real;
+        break;
+    case Slot::QuartersPerBar:
+        quartersPerBar = value.toJson();
+        break;
+    case Slot::Signature:
+        signatureIsArray = false;
+        break;
+    case Slot::SignatureValue:
+        if (value.type == Value::Unsigned) {
+            if (signatureIndex == 0)
+                signatureNum = static_cast<int>(value.unsignedInteger);
+            else if (signatureIndex == 1)
+                signatureDenom = static_cast<int>(value.unsignedInteger);
+        }
+        signatureIndex++;
+        signatureSize++;
+        break;
+    case Slot::Intro:
+    case Slot::Ending:
+    case Slot::MainLoop:
+    case Slot::Fill:
+    case Slot::Transition:
+        setSequence(slot, PendingSequence {});
+        break;
+    case Slot::Parts:
+        partsIsArray = false;
+        break;
+    case Slot::Part:
+        partsSize++;
+        break;
+    case Slot::PartName:
+        if (value.type == Value::String)
+            part.name = *value.string;
+        break;
+    case Slot::Fills:
+        part.fills.clear();
+        break;
+    case Slot::SequenceField:
+        fileFields[currentKey] = value.toJson();
+        hasFilename |= (currentKey == "filename");
+        break;
+    case Slot::Notes:
+        hasNotes = true;
+        notesError = ReadingError::WrongNoteListFormat;
+        break;
+    case Slot::Note:
+        if (metadataOnly)
+            numNotes++;
+        else if (!notesError)
+            notesError = ReadingError::WrongTimeFormat;
+        break;
+    case Slot::NoteTime:
+    case Slot::NoteDuration:
+    case Slot::NoteNumber:
+    case Slot::NoteVelocity:
+        setNoteField(slot, &value);
+        break;
+    case Slot::Skip:
+        break;
+    }
+    return true;
+}
+
+bool BeatSaxHandler::open(bool isObject)
+{
+    if (stack.empty()) {
+        rootIsObject = isObject;
+        stack.push_back(isObject ? Container::Root : Container::Skip);
+        return true;
+    }
+
+    const auto slot = nextSlot();
+    auto container = Container::Skip;
+    switch (slot) {
+    case Slot::Name:
+        name.reset();
+        break;
+    case Slot::QuartersPerBar:
+        quartersPerBar = isObject ? json::object() : json::array();
+        break;
+    case Slot::Signature:
+        signatureIsArray = !isObject;
+        signatureSize = 0;
+        signatureIndex = 0;
+        signatureNum.reset();
+        signatureDenom.reset();
+        if (!isObject)
+            container = Container::Signature;
+        break;
+    case Slot::SignatureValue:
+        signatureIndex++;
+        signatureSize++;
+        break;
+    case Slot::Intro:
+    case Slot::Ending:
+    case Slot::MainLoop:
+    case Slot::Fill:
+    case Slot::Transition:
+        if (isObject) {
+            sequenceSlot = slot;
+            fileFields = json::object();
+            hasFilename = false;
+            hasNotes = false;
+            notesError.reset();
+            notes.clear();
+            numNotes = 0;
+            container = Container::Sequence;
+        } else {
+            setSequence(slot, PendingSequence {});
+        }
+        break;
+    case Slot::Parts:
+        partsIsArray = !isObject;
+        partsSize = 0;
+        parts.clear();
+        if (!isObject)
+            container = Container::Parts;
+        break;
+    case Slot::Part:
+        partsSize++;
+        if (isObject) {
+            startPart();
+            container = Container::Part;
+        }
+        break;
+    case Slot::Fills:
+        part.fills.clear();
+        if (!isObject)
+            container = Container::Fills;
+        break;
+    case Slot::SequenceField:
+        fileFields[currentKey] = isObject ? json::object() : json::array();
+        hasFilename |= (currentKey == "filename");
+        break;
+    case Slot::Notes:
+        hasNotes = true;
+        notes.clear();
+        numNotes = 0;
+        notesError.reset();
+        if (isObject)
+            notesError = ReadingError::WrongNoteListFormat;
+        else
+            container = Container::Notes;
+        break;
+    case Slot::Note:
+        if (metadataOnly) {
+            numNotes++;
+        } else if (isObject) {
+            time = duration = number = velocity = NoteField {};
+            container = Container::Note;
+        } else if (!notesError) {
+            notesError = ReadingError::WrongTimeFormat;
+        }
+        break;
+    case Slot::NoteTime:
+    case Slot::NoteDuration:
+    case Slot::NoteNumber:
+    case Slot::NoteVelocity:
+        setNoteField(slot, nullptr);
+        break;
+    case Slot::Group:
+    case Slot::Bpm:
+    case Slot::PartName:
+    case Slot::Skip:
+        break;
+    }
+
+    stack.push_back(container);
+    return true;
+}
+
+bool BeatSaxHandler::close()
+{
+    const auto container = stack.back();
+    stack.pop_back();
+    switch (container) {
+    case Container::Sequence:
+        setSequence(sequenceSlot, finishSequence());
+        break;
+    case Container::Note:
+        finishNote();
+        break;
+    case Container::Part:
+        finishPart();
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+void BeatSaxHandler::setSequence(Slot slot, PendingSequence&& sequence)
+{
+    switch (slot) {
+    case Slot::Intro:
+        intro = std::move(sequence);
+        break;
+    case Slot::Ending:
+        ending = std::move(sequence);
+        break;
+    case Slot::MainLoop:
+        part.mainLoop = std::move(sequence);
+        break;
+    case Slot::Fill:
+        part.fills.push_back(std::move(sequence));
+        break;
+    case Slot::Transition:
+        part.transition = std::move(sequence);
+        break;
+    default:
+        break;
+    }
+}
+
+void BeatSaxHandler::setNoteField(Slot slot, const Value* value)
+{
+    NoteField field;
+    if (!value)
+        field.kind = NoteField::Other;
+    else if (value->type == Value::Integer || value->type == Value::Unsigned) {
+        field.kind = NoteField::Integer;
+        field.integer = value->integer;
+    } else if (value->type == Value::Float) {
+        field.kind = NoteField::Float;
+        field.real = value->real;
+    } else
+        field.kind = NoteField::Other;
+
+    switch (slot) {
+    case Slot::NoteTime: time = field; break;
+    case Slot::NoteDuration: duration = field; break;
+    case Slot::NoteNumber: number = field; break;
+    case Slot::NoteVelocity: velocity = field; break;
+    default: break;
+    }
+}
+
+void BeatSaxHandler::finishNote()
+{
+    if (notesError)
+        return;
+
+    // Same checks, in the same order, as readSequenceFromNoteList
+    if (time.kind != NoteField::Float || time.real < 0.0) {
+        notesError = ReadingError::WrongTimeFormat;
+        return;
+    }
+
+    if (duration.kind != NoteField::Float || duration.real < 0.0) {
+        notesError = ReadingError::WrongNoteDuration;
+        return;
+    }
+
+    const auto noteNumber = static_cast<uint8_t>(number.integer);
+    if (number.kind != NoteField::Integer || noteNumber > 127) {
+        notesError = ReadingError::WrongNoteNumber;
+        return;
+    }
+
+    if (velocity.kind != NoteField::Float) {
+        notesError = ReadingError::WrongNoteValue;
+        return;
+    }
+
+    notes.emplace_back(time.real, duration.real, noteNumber, static_cast<float>(velocity.real));
+}
+
+PendingSequence BeatSaxHandler::finishSequence()
+{
+    if (hasFilename && metadataOnly) {
+        const auto filename = fileFields.find("filename");
+        if (!filename->is_string() || !fs::exists(rootDirectory / filename->get<std::string>()))
+            return PendingSequence { tl::make_unexpected(ReadingError::MidiFileError) };
+
+        return PendingSequence { Sequence {} };
+    }
+
+    if (hasFilename) {
+        if (!fileFields.find("filename")->is_string())
+            return PendingSequence { tl::make_unexpected(ReadingError::NoFilename) };
+
+        fileReferences.push_back(std::move(fileFields));
+        return PendingSequence { fileReferences.size() - 1 };
+    }
+
+    if (!hasNotes)
+        return PendingSequence {};
+
+    if (notesError)
+        return PendingSequence { tl::make_unexpected(*notesError) };
+
+    if (notes.empty() && numNotes == 0)
+        return PendingSequence { tl::make_unexpected(ReadingError::NoDataRead) };
+
+    if (metadataOnly)
+        return PendingSequence { Sequence {} };
+
+    Sequence sequence(notes.begin(), notes.end());
+    std::sort(sequence.begin(), sequence.end(), [](const Note& lhs, const Note& rhs) {
+        return lhs.timestamp < rhs.timestamp;
+    });
+    return PendingSequence { std::move(sequence) };
+}
+
+SequenceResult BeatSaxHandler::resolve(PendingSequence& sequence, std::vector<SequenceResult>& files)
+{
+    if (sequence.file != noFile)
+        return std::move(files[sequence.file]);
+
+    return std::move(sequence.result);
+}
+
+void BeatSaxHandler::startPart()
+{
+    part = PendingPart {};
+}
+
+void BeatSaxHandler::finishPart()
+{
+    parts.push_back(std::move(part));
+}
+
+template <class Beat>
+bool BeatSaxHandler::finishHeader(Beat& beat, std::error_code& error)
+{
+    // Same checks, in the same order, as buildDescriptionFromJson
+    if (!rootIsObject || !name) {
+        error = BeatDescriptionError::NoFilename;
+        return false;
+    }
+
+    if (!partsIsArray || partsSize == 0) {
+        error = BeatDescriptionError::NoParts;
+        return false;
+    }
+
+    beat.name = std::move(*name);
+    beat.group = std::move(group);
+    beat.bpm = static_cast<float>(bpm.value_or(120.0));
+
+    beat.quartersPerBar = 4;
+    beat.signature = { 4, 4 };
+    if (quartersPerBar) {
+        beat.quartersPerBar = checkQuartersPerBar(*quartersPerBar).value_or(beat.quartersPerBar);
+        beat.signature.num = static_cast<int>(beat.quartersPerBar);
+    } else if (signatureIsArray && signatureSize == 2) {
+        if (signatureNum)
+            beat.signature.num = *signatureNum;
+
+        if (signatureDenom)
+            beat.signature.denom = *signatureDenom;
+
+        beat.quartersPerBar = beat.signature.num * 4.0 / beat.signature.denom;
+    }
+
+    return true;
+}
+
+std::unique_ptr<BeatDescription> BeatSaxHandler::finish(std::error_code& error)
+{
+    auto beat = std::unique_ptr<BeatDescription>(new BeatDescription());
+    if (!finishHeader(*beat, error))
+        return {};
+
+    auto files = readSequences(fileReferences, rootDirectory);
+
+    if (auto sequence = resolve(intro, files))
+        beat->intro = std::move(*sequence);
+
+    if (auto sequence = resolve(ending, files))
+        beat->ending = std::move(*sequence);
+
+    for (auto& pending : parts) {
+        auto mainLoop = resolve(pending.mainLoop, files);
+        if (!mainLoop)
+            continue;
+
+        Part newPart;
+        newPart.name = std::move(pending.name);
+        newPart.mainLoop = std::move(*mainLoop);
+        for (auto& fill : pending.fills) {
+            if (auto sequence = resolve(fill, files))
+                newPart.fills.push_back(std::move(*sequence));
+        }
+
+        if (auto sequence = resolve(pending.transition, files))
+            newPart.transition = std::move(*sequence);
+
+        beat->parts.push_back(std::move(newPart));
+    }
+
+    if (beat->parts.empty()) {
+        error = BeatDescriptionError::NoParts;
+        return {};
+    }
+
+    if (!beat->compile(error))
+        return {};
+
+    return beat;
+}
+
+bool BeatSaxHandler::finishMetadata(BeatInfo& info, std::error_code& error)
+{
+    if (!finishHeader(info, error))
+        return false;
+
+    // The parts that buildDescriptionFromJson would keep
+    info.parts.clear();
+    for (auto& pending : parts) {
+        if (!pending.mainLoop.result)
+            continue;
+
+        PartInfo part { std::move(pending.name), 0 };
+        for (auto& fill : pending.fills)
+            part.numFills += fill.result ? 1 : 0;
+
+        info.parts.push_back(std::move(part));
+    }
+
+    if (info.parts.empty()) {
+        error = BeatDescriptionError::NoParts;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Copy a JSON text, replacing the content of the note lists (arrays
+ * under a "notes" key) with a single 0, or nothing if they are empty. Finding
+ * the brackets is much cheaper than reading thousands of numbers. Malformed
+ * text is copied as is from where it stops making sense.
+ */
+std::string skipNoteLists(const char* begin, const char* end)
+{
+    constexpr char key[] { "\"notes\"" };
+    constexpr std::size_t keySize { sizeof(key) - 1 };
+    const auto isSpace = [](char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; };
+
+    std::string text;
+    text.reserve(4096);
+    const char* copied = begin;
+    const char* p = begin;
+    while (p < end) {
+        if (*p != '"') {
+            ++p;
+            continue;
+        }
+
+        const char* stringStart = p++;
+        while (p < end && *p != '"')
+            p += (*p == '\\') ? 2 : 1;
+
+        if (p >= end)
+            break;
+
+        ++p;
+        if (static_cast<std::size_t>(p - stringStart) != keySize || !std::equal(stringStart, p, key))
+            continue;
+
+        const char* q = p;
+        while (q < end && isSpace(*q))
+            ++q;
+        if (q >= end || *q != ':')
+            continue;
+        ++q;
+        while (q < end && isSpace(*q))
+            ++q;
+        if (q >= end || *q != '[')
+            continue;
+
+        // Find the matching bracket, and whether there is anything before it
+        const char* listStart = ++q;
+        int depth = 1;
+        bool isEmpty = true;
+        while (q < end && depth > 0) {
+            if (*q == '"') {
+                ++q;
+                while (q < end && *q != '"')
+                    q += (*q == '\\') ? 2 : 1;
+                if (q >= end)
+                    break;
+            } else if (*q == '[' || *q == '{') {
+                depth++;
+            } else if (*q == ']' || *q == '}') {
+                depth--;
+            }
+            if (depth > 0 && !isSpace(*q))
+                isEmpty = false;
+            ++q;
+        }
+
+        if (depth > 0)
+            break;
+
+        text.append(copied, listStart);
+        text += isEmpty ? "]" : "0]";
+        copied = p = q;
+    }
+
+    text.append(copied, end);
+    return text;
+}
+
+}
+
+std::unique_ptr<BeatDescription> readBeatDescription(const char* begin, const char* end, const fs::path& virtualFile, std::error_code& error)
+{
+    const auto rootDirectory = virtualFile.parent_path();
+    BeatSaxHandler handler { rootDirectory };
+    if (!json::sax_parse(begin, end, &handler)) {
+        error = BeatDescriptionError::InvalidJson;
+        return {};
+    }
+
+    return handler.finish(error);
+}
+
+bool readBeatMetadata(const char* begin, const char* end, const fs::path& virtualFile, BeatInfo& info, std::error_code& error)
+{
+    const auto rootDirectory = virtualFile.parent_path();
+    BeatSaxHandler handler { rootDirectory, true };
+    const auto text = skipNoteLists(begin, end);
+    if (!json::sax_parse(text.data(), text.data() + text.size(), &handler)) {
+        error = BeatDescriptionError::InvalidJson;
+        return false;
+    }
+
+    return handler.finishMetadata(info, error);
+}
+
+}
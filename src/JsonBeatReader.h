@@ -0,0 +1,42 @@
+#pragma once
+#include "BeatDescription.h"
+#include "json.hpp"
+#include <memory>
+#include <system_error>
+
+namespace batteur {
+
+struct BeatInfo;
+
+/**
+ * @brief Read a JSON beat description without building a JSON document.
+ *
+ * The text goes through nlohmann's SAX interface and the notes are written
+ * directly in the sequences of the description. The result and the errors are
+ * the same as with `buildDescriptionFromJson`: a sequence that fails to read
+ * with a `ReadingError` is skipped in the same way, and the description fails
+ * with the same `BeatDescriptionError`. Malformed JSON fails with
+ * `BeatDescriptionError::InvalidJson`.
+ *
+ * @param virtualFile the path of the description; MIDI files are looked up
+ *                    relative to its directory
+ */
+std::unique_ptr<BeatDescription> readBeatDescription(const char* begin, const char* end, const fs::path& virtualFile, std::error_code& error);
+
+/**
+ * @brief Read only the metadata of a JSON beat description: its name, group,
+ * tempo and signature, and the names and fill counts of the parts that
+ * `readBeatDescription` would keep. The notes are not read: a sequence is
+ * assumed valid if its note list is not empty or its MIDI file exists.
+ *
+ * @return false with the error `readBeatDescription` would give
+ */
+bool readBeatMetadata(const char* begin, const char* end, const fs::path& virtualFile, BeatInfo& info, std::error_code& error);
+
+/**
+ * @brief Build a beat description from a parsed JSON document. This was the
+ * only loader before the streaming reader, and is kept as its reference.
+ */
+std::unique_ptr<BeatDescription> buildDescriptionFromJson(const fs::path& virtualFile, const nlohmann::json& json, std::error_code& error);
+
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+namespace batteur {
+
+/**
+ * @brief A bounded, time-ordered queue of note events.
+ *
+ * Events are stored in a binary min-heap keyed by their absolute time in
+ * samples, so that inserting or removing an event is O(log n). Events scheduled
+ * at the same time come out in the order they were pushed. The storage is fixed
+ * at compile time and the queue never allocates, which makes it safe to use on
+ * the audio thread.
+ *
+ * Overflow policy: notes are pushed as on/off pairs through `pushNote`, which
+ * drops the whole note if there is no room left for both events. A note-on is
+ * thus never queued without its matching note-off.
+ *
+ * @tparam N the maximum number of events (not notes) held by the queue
+ */
+template <unsigned N>
+class NoteQueue {
+public:
+    struct Event {
+        int delay;
+        uint8_t number;
+        float velocity;
+    };
+
+    /**
+     * @brief Queue a note-on and its note-off
+     *
+     * @param onDelay the note-on delay from the start of the current block
+     * @param offDelay the note-off delay from the start of the current block
+     * @param number the note number
+     * @param velocity the note velocity
+     * @return false if the queue was full and the note was dropped
+     */
+    bool pushNote(int onDelay, int offDelay, uint8_t number, float velocity) noexcept
+    {
+        if (count + 2 > N)
+            return false;
+
+        push(onDelay, number, velocity);
+        push(offDelay, number, 0.0f);
+        return true;
+    }
+
+    /**
+     * @brief Pop the next event if it happens before a given delay
+     *
+     * @param before the delay (exclusive) from the start of the current block
+     * @param event the popped event, with its delay relative to the current block
+     * @return true if an event was popped
+     */
+    bool pop(int before, Event& event) noexcept
+    {
+        if (count == 0 || heap[0].time - now >= before)
+            return false;
+
+        event = { static_cast<int>(heap[0].time - now), heap[0].number, heap[0].velocity };
+        heap[0] = heap[--count];
+        siftDown(0);
+        return true;
+    }
+
+    /**
+     * @brief Move the start of the current block forward. Delays of the queued
+     * events are reduced by the same amount.
+     */
+    void advance(int sampleCount) noexcept { now += sampleCount; }
+
+    void clear() noexcept { count = 0; }
+    bool empty() const noexcept { return count == 0; }
+    unsigned size() const noexcept { return count; }
+    static constexpr unsigned capacity() noexcept { return N; }
+
+private:
+    struct Entry {
+        int64_t time;
+        uint32_t order;
+        uint8_t number;
+        float velocity;
+    };
+
+    static bool before(const Entry& lhs, const Entry& rhs) noexcept
+    {
+        if (lhs.time != rhs.time)
+            return lhs.time < rhs.time;
+
+        // Wrap-around safe comparison of the insertion order
+        return static_cast<int32_t>(lhs.order - rhs.order) < 0;
+    }
+
+    void push(int delay, uint8_t number, float velocity) noexcept
+    {
+        unsigned i = count++;
+        const Entry entry { now + delay, nextOrder++, number, velocity };
+        while (i > 0) {
+            const unsigned parent = (i - 1) / 2;
+            if (!before(entry, heap[parent]))
+                break;
+
+            heap[i] = heap[parent];
+            i = parent;
+        }
+        heap[i] = entry;
+    }
+
+    void siftDown(unsigned i) noexcept
+    {
+        const Entry entry = heap[i];
+        while (true) {
+            unsigned child = 2 * i + 1;
+            if (child >= count)
+                break;
+
+            if (child + 1 < count && before(heap[child + 1], heap[child]))
+                child++;
+
+            if (!before(heap[child], entry))
+                break;
+
+            heap[i] = heap[child];
+            i = child;
+        }
+        heap[i] = entry;
+    }
+
+    std::array<Entry, N> heap;
+    unsigned count { 0 };
+    int64_t now { 0 };
+    uint32_t nextOrder { 0 };
+};
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "tl/optional.hpp"
+
+namespace batteur {
+
+/**
+ * @brief Resolution of the player timeline. This is a multiple of all the
+ * usual MIDI file divisions, and is fine enough to stay below a sample for
+ * any realistic tempo and sample rate.
+ */
+constexpr int64_t ticksPerQuarter { 1612800 };
+
+int64_t quartersToTicks(double quarters) noexcept;
+
+/**
+ * @brief A read-only view over an array owned by someone else.
+ */
+template <class T>
+class ArrayView {
+public:
+    ArrayView() = default;
+    ArrayView(const T* data, std::size_t size) noexcept : ptr(data), count(size) {}
+    const T* data() const noexcept { return ptr; }
+    std::size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return count == 0; }
+    const T& operator[](std::size_t index) const noexcept { return ptr[index]; }
+    const T& front() const noexcept { return ptr[0]; }
+    const T& back() const noexcept { return ptr[count - 1]; }
+    const T* begin() const noexcept { return ptr; }
+    const T* end() const noexcept { return ptr + count; }
+private:
+    const T* ptr { nullptr };
+    std::size_t count { 0 };
+};
+
+/**
+ * @brief A sequence compiled for playback.
+ *
+ * Notes are stored as parallel arrays sorted by onset, with times in integer
+ * ticks. Since the timeline is in ticks and not in samples, the compiled form
+ * does not depend on the tempo or the sample rate and never has to be rebuilt
+ * once the beat is loaded.
+ *
+ * The arrays are views into the binary form of the beat (see BinaryBeat.h),
+ * which the beat description keeps alive.
+ */
+struct PlaybackSequence {
+    ArrayView<int64_t> onTicks;
+    ArrayView<int64_t> offTicks;
+    ArrayView<uint8_t> numbers;
+    ArrayView<float> velocities;
+    int64_t durationTicks { 0 }; // Rounded up to a whole number of bars
+    std::size_t size() const noexcept { return onTicks.size(); }
+    bool empty() const noexcept { return onTicks.empty(); }
+};
+
+struct PartPlayback {
+    PlaybackSequence mainLoop;
+    std::vector<PlaybackSequence> fills;
+    tl::optional<PlaybackSequence> transition;
+};
+
+struct BeatPlayback {
+    int64_t barTicks { 4 * ticksPerQuarter };
+    tl::optional<PlaybackSequence> intro;
+    std::vector<PartPlayback> parts;
+    tl::optional<PlaybackSequence> ending;
+};
+
+}
@@ -1,67 +1,108 @@
 #include "Player.h"
 #include "BeatDescription.h"
 #include "MathHelpers.h"
+#include <algorithm>
 #include <cmath>
+#include <thread>
 
 namespace batteur {
 
 Player::Player()
 {
     queuedSequences.reserve(4);
-    deferredNotes.reserve(1024);
-    potentialNotesToMerge.reserve(128);
+    updateTickRates();
 }
 
 bool Player::loadBeatDescription(const BeatDescription& description)
 {
-    const std::unique_lock<std::mutex> lock { callbackGuard };
-    
-    if (description.parts.empty())
+    if (description.playback.parts.empty())
         return false;
 
-    currentBeat = &description;
     setTempo(description.bpm);
-    reset();
+    queuedBeat.store(nullptr);
+    publishedBeat.store(&description);
+    pendingBeat.store(&description);
+    waitForTick();
+    // The tick that was running may have switched to a queued beat and
+    // published it; the loaded beat is the current one from now on
+    if (pendingBeat.load() == &description)
+        publishedBeat.store(&description);
+    return true;
+}
+
+bool Player::queueBeatDescription(const BeatDescription& description, SwitchPoint switchPoint, TempoChange tempoChange)
+{
+    if (description.playback.parts.empty())
+        return false;
+
+    queuedSwitchPoint.store(switchPoint);
+    queuedTempoChange.store(tempoChange);
+    queuedRequestedTempo.store(requestedTempo.load());
+    queuedBeat.store(&description);
+    waitForTick();
     return true;
 }
 
+void Player::cancelQueuedBeat()
+{
+    queuedBeat.store(nullptr);
+    waitForTick();
+}
+
+void Player::waitForTick() const noexcept
+{
+    // A tick that starts after this point will pick up any newly published
+    // beat or reset request before touching the current beat. Only a tick
+    // that is already running may still hold on to the previous beat.
+    const auto epoch = tickEpoch.load();
+    if ((epoch & 1) == 0)
+        return;
+
+    while (tickEpoch.load() == epoch)
+        std::this_thread::yield();
+}
+
 void Player::reset()
 {
     state = State::Stopped;
-    position = 0.0;
+    position = 0;
+    tickRemainder = 0;
     queuedSequences.clear();
+    cursor = 0;
     fillIndex = 0;
     partIndex = 0;
+    switchArmed = false;
 }
 
-bool Player::start()
+bool Player::start(int frame)
 {
-    return messages.try_push(Message::Start);
+    return messages.try_push(Command { Message::Start, std::max(frame, 0) });
 }
 
-bool Player::stop()
+bool Player::stop(int frame)
 {
-    return messages.try_push(Message::Stop);
+    return messages.try_push(Command { Message::Stop, std::max(frame, 0) });
 }
 
-bool Player::fillIn()
+bool Player::fillIn(int frame)
 {
-    return messages.try_push(Message::Fill);
+    return messages.try_push(Command { Message::Fill, std::max(frame, 0) });
 }
 
-bool Player::next()
+bool Player::next(int frame)
 {
-    return messages.try_push(Message::Next);
+    return messages.try_push(Command { Message::Next, std::max(frame, 0) });
 }
 
 void Player::_start()
 {
-    if (currentBeat->intro) {
-        queuedSequences.push_back(&*currentBeat->intro);
-        queuedSequences.push_back(&currentBeat->parts[partIndex].mainLoop);
+    const auto& playback = currentBeat->playback;
+    if (playback.intro) {
+        queuedSequences.push_back(&*playback.intro);
+        queuedSequences.push_back(&playback.parts[partIndex].mainLoop);
         state = State::Intro;
     } else {
-        queuedSequences.push_back(&currentBeat->parts[partIndex].mainLoop);
+        queuedSequences.push_back(&playback.parts[partIndex].mainLoop);
         state = State::Playing;
     }
 }
@@ -71,26 +112,27 @@ void Player::_stop()
     while (queuedSequences.size() > 1)
         queuedSequences.pop_back();
 
-    if (currentBeat->ending)
-        queuedSequences.push_back(&*currentBeat->ending);
+    if (currentBeat->playback.ending)
+        queuedSequences.push_back(&*currentBeat->playback.ending);
 
     state = State::Ending;
 }
 
 void Player::_fillIn()
 {
-    if (currentBeat->parts[partIndex].fills.empty())
+    const auto& part = currentBeat->playback.parts[partIndex];
+    if (part.fills.empty())
         return;
 
-    queuedSequences.push_back(&currentBeat->parts[partIndex].fills[fillIndex]);
-    queuedSequences.push_back(&currentBeat->parts[partIndex].mainLoop);
+    queuedSequences.push_back(&part.fills[fillIndex]);
+    queuedSequences.push_back(&part.mainLoop);
     state = State::Fill;
-    fillIndex = (fillIndex + 1) % currentBeat->parts[partIndex].fills.size();
+    fillIndex = (fillIndex + 1) % part.fills.size();
 }
 
 void Player::_next()
 {
-    const auto& currentTransition = currentBeat->parts[partIndex].transition;
+    const auto& currentTransition = currentBeat->playback.parts[partIndex].transition;
     if (enteringFillInState()) {
         queuedSequences.pop_back(); // Remove the back (which should be the next part)
         if (currentTransition) {
@@ -104,88 +146,250 @@ void Player::_next()
             queuedSequences.push_back(&currentTransition.value());
         }
     }
-    partIndex = (partIndex + 1) % currentBeat->parts.size();
+    partIndex = (partIndex + 1) % currentBeat->playback.parts.size();
     fillIndex = 0;
-    queuedSequences.push_back(&currentBeat->parts[partIndex].mainLoop);
+    queuedSequences.push_back(&currentBeat->playback.parts[partIndex].mainLoop);
     state = State::Next;
 }
 
-void Player::updateState()
+void Player::applyCommand(Message message)
 {
-    Message msg;
-    while (messages.try_pop(msg)) {
-        switch (msg) {
-        case Message::Start:
-            if (state == State::Stopped)
-                _start();
-            break;
-        case Message::Stop:
-            if (state != State::Stopped && state != State::Ending)
-                _stop();
-            break;
-        case Message::Fill:
-            if (state == State::Playing)
-                _fillIn();
-            break;
-        case Message::Next:
-            if (state == State::Playing || state == State::Fill)
-                _next();
-            break;
+    // A switch at the end of the part waits for the fill or the part change
+    if (message != Message::Start && nextSwitchPoint == SwitchPoint::EndOfPart)
+        switchArmed = false;
+
+    switch (message) {
+    case Message::Start:
+        if (state == State::Stopped)
+            _start();
+        break;
+    case Message::Stop:
+        if (state != State::Stopped && state != State::Ending) {
+            _stop();
+            switchArmed = false;
         }
+        break;
+    case Message::Fill:
+        if (state == State::Playing)
+            _fillIn();
+        break;
+    case Message::Next:
+        if (state == State::Playing || state == State::Fill)
+            _next();
+        break;
+    }
+}
+
+void Player::pullCommands() noexcept
+{
+    // Commands with the same frame keep the order in which they were sent
+    Command command;
+    while (numPendingCommands < maxCommands && messages.try_pop(command)) {
+        auto i = numPendingCommands++;
+        for (; i > 0 && pendingCommands[i - 1].frame > command.frame; --i)
+            pendingCommands[i] = pendingCommands[i - 1];
+
+        pendingCommands[i] = command;
     }
 }
 
 void Player::tick(int sampleCount)
 {
-    const std::unique_lock<std::mutex> lock { callbackGuard, std::try_to_lock };
-    if (!lock.owns_lock())
-        return;
+    tick(sampleCount, noteCallback);
+}
+
+int Player::tick(int sampleCount, NoteEvent* events, int capacity)
+{
+    const TickEpochGuard epochGuard { tickEpoch };
+    schedule(sampleCount);
+
+    int count { 0 };
+    const auto sink = [events, &count](int delay, uint8_t number, float velocity) {
+        events[count++] = { delay, number, velocity };
+    };
+    emit(sampleCount, sink, capacity);
+    return count;
+}
+
+void Player::schedule(int sampleCount)
+{
+    if (pendingBeat.load() != nullptr) {
+        currentBeat = pendingBeat.exchange(nullptr);
+        nextBeat = nullptr;
+        reset();
+        // A tick that ran during the load may have published the beat it
+        // switched to afterwards
+        publishedBeat.store(currentBeat);
+    }
+
+    if (resetRequested.load() && resetRequested.exchange(false))
+        reset();
+
+    pickQueuedBeat();
+    applyRequestedSampleRate();
+    applyRequestedTempo();
 
     if (!currentBeat)
         return;
 
-    updateState();
+    pullCommands();
+
+    // Split the block at the frame of each command that falls into it
+    int offset { 0 };
+    unsigned applied { 0 };
+    while (applied < numPendingCommands && pendingCommands[applied].frame < sampleCount) {
+        const auto& command = pendingCommands[applied++];
+        const int frame = std::max(command.frame, offset);
+        scheduleNotes(offset, frame - offset);
+        applyCommand(command.message);
+        offset = frame;
+    }
+    scheduleNotes(offset, sampleCount - offset);
+
+    for (unsigned i = applied; i < numPendingCommands; ++i) {
+        pendingCommands[i - applied] = pendingCommands[i];
+        pendingCommands[i - applied].frame -= sampleCount;
+    }
+    numPendingCommands -= applied;
+}
+
+void Player::pickQueuedBeat() noexcept
+{
+    const auto beat = queuedBeat.load();
+    const auto switchPoint = queuedSwitchPoint.load();
+    const auto tempoChange = queuedTempoChange.load();
+    if (beat != nextBeat || switchPoint != nextSwitchPoint || tempoChange != nextTempoChange) {
+        nextBeat = beat;
+        nextSwitchPoint = switchPoint;
+        nextTempoChange = tempoChange;
+        switchArmed = false;
+        glideRequestedTempo = queuedRequestedTempo.load();
+    }
+
+    if (nextBeat && (!currentBeat || state == State::Stopped)) {
+        takeOverNextBeat();
+        reset();
+    }
+}
+
+void Player::armSwitch() noexcept
+{
+    if (state == State::Ending)
+        return;
+
+    const auto front = queuedSequences.front();
+    if (nextSwitchPoint == SwitchPoint::NextBar) {
+        // The notes at the position may already be played, so a bar line
+        // right at the position is too late
+        const auto barTicks = currentBeat->playback.barTicks;
+        const auto bar = position / barTicks;
+        switchTick = ((position < 0 && bar * barTicks != position ? bar - 1 : bar) + 1) * barTicks;
+    } else if (state == State::Playing && queuedSequences.size() == 1) {
+        switchTick = front->durationTicks;
+    } else {
+        return;
+    }
+
+    switchArmed = true;
+    glideStartTempo = 60.0 / secondsPerQuarter;
+    glideTicks = switchTick - position;
+}
+
+void Player::takeOverNextBeat() noexcept
+{
+    currentBeat = nextBeat;
+    queuedSequences.clear();
+    queuedSequences.push_back(&currentBeat->playback.parts[0].mainLoop);
+    cursor = 0;
+    fillIndex = 0;
+    partIndex = 0;
+    state = State::Playing;
+
+    if (isGliding()) {
+        auto expected = glideRequestedTempo;
+        requestedTempo.compare_exchange_strong(expected, static_cast<double>(currentBeat->bpm));
+    }
+
+    publishedBeat.store(currentBeat);
+    auto expected = nextBeat;
+    queuedBeat.compare_exchange_strong(expected, nullptr);
+    nextBeat = nullptr;
+    switchArmed = false;
+}
 
+void Player::scheduleNotes(int offset, int sampleCount)
+{
     if (queuedSequences.empty())
         return;
 
-    const auto currentQPB = currentBeat->quartersPerBar;
+    auto barTicks = currentBeat->playback.barTicks;
     auto blockStart = position;
-    double blockEnd = blockStart + samplesToQuarter(sampleCount);
-    const auto midiDelay = [&] (double timestamp) -> int {
-        return quarterToSamples(timestamp - blockStart);
+    const auto blockRemainder = tickRemainder;
+    auto blockEnd = blockStart + samplesToTicks(sampleCount);
+    const auto midiDelay = [&] (int64_t tick) -> int {
+        return offset + ticksToSamples(tick - blockStart, blockRemainder);
     };
 
     auto current = queuedSequences.front(); // Otherwise we have ** everywhere..
-    auto noteIt = current->begin();
+    auto noteIndex = cursor;
 
-    const auto barStartedAt = [currentQPB] (double pos) -> double {
-        const auto barPosition = pos / currentQPB;
-        return std::floor(barPosition) * currentQPB;
+    const auto barStartedAt = [&barTicks] (int64_t pos) -> int64_t {
+        const auto bar = pos / barTicks;
+        return (pos < 0 && bar * barTicks != pos ? bar - 1 : bar) * barTicks;
     };
 
-    const auto movePosition = [&] (double offset) {
+    // The note index only moves forward while the position does, so that
+    // the search below only goes through the notes skipped since the last
+    // note played. Any backward move needs to restart from the beginning.
+    const auto movePosition = [&] (int64_t offset) {
         blockEnd += offset; 
         blockStart += offset; 
         position += offset;
+        switchTick += offset;
+        if (offset < 0)
+            noteIndex = 0;
     };
 
     const auto eraseFrontSequence = [&] {
         queuedSequences.erase(queuedSequences.begin());
         current = queuedSequences.front();
-        noteIt = current->begin();
+        noteIndex = 0;
         movePosition(-barStartedAt(position));
+        if (nextSwitchPoint == SwitchPoint::EndOfPart)
+            switchArmed = false;
     };
 
+    // The new beat starts at the switch tick, which becomes its tick 0
+    const auto switchToNextBeat = [&] {
+        movePosition(-switchTick);
+        takeOverNextBeat();
+        position = 0;
+        current = queuedSequences.front();
+        noteIndex = 0;
+        barTicks = currentBeat->playback.barTicks;
+    };
 
     while (state != State::Stopped) {
-        noteIt = std::find_if(
-            noteIt,
-            current->end(),
-            [&](const Sequence::value_type& v) { return v.timestamp >= position; }
-        );
+        const auto numNotes = current->size();
+        const int64_t* onTicks = current->onTicks.data();
+        while (noteIndex < numNotes && onTicks[noteIndex] < position)
+            noteIndex++;
+
+        if (nextBeat && !switchArmed)
+            armSwitch();
+
+        if (switchArmed && switchTick <= blockEnd) {
+            // A fill that ran out of notes first hands over to the loop, which
+            // may still have notes before the switch
+            const bool frontEnds = noteIndex == numNotes && queuedSequences.size() == 2 && state != State::Ending;
+            const auto upcoming = noteIndex < numNotes ? onTicks[noteIndex] : current->durationTicks;
+            if (!frontEnds && upcoming >= switchTick) {
+                switchToNextBeat();
+                continue;
+            }
+        }
     
-        if (noteIt == current->end()) {
+        if (noteIndex == numNotes) {
             if (queuedSequences.size() == 2 && state != State::Ending) {
                 // DBG("Exiting fill-in state: removing the top sequence");
                 eraseFrontSequence();
@@ -193,17 +397,18 @@ void Player::tick(int sampleCount)
                 continue;
             }
 
-            const auto sequenceDuration = 
-                barCount(*current, currentQPB) * currentQPB;
+            const auto sequenceDuration = current->durationTicks;
 
             if (blockEnd < sequenceDuration) {
                 position = blockEnd;
+                cursor = noteIndex;
                 break;
             }
 
             blockEnd -= sequenceDuration;
             blockStart -= sequenceDuration; // will be negative but it's OK!
-            position = 0.0;
+            switchTick -= sequenceDuration;
+            position = 0;
 
             if (queuedSequences.size() == 1 && state == State::Ending) {
                 // DBG("Ending finished; resetting");
@@ -211,19 +416,18 @@ void Player::tick(int sampleCount)
                 break;
             }
 
-            noteIt = current->begin();
+            noteIndex = 0;
         }        
 
         if (enteringFillInState() || enteringEndingState()) {
             const auto barStart = barStartedAt(position);
             const auto relPosition = position - barStart;
-            const auto qpb = currentBeat->quartersPerBar;
-            const auto barThreshold = qpb - 0.7;
-            const auto relFillStart = queuedSequences[1]->front().timestamp;
+            const auto barThreshold = barTicks - fillThresholdTicks;
+            const auto relFillStart = queuedSequences[1]->onTicks.front();
             // DBG("Could start fill in; relative position: " << relPosition
             //     << ", fill start at " << relFillStart);
             if (relPosition > barThreshold) {
-                if(relFillStart > barThreshold && relFillStart < relPosition && relFillStart < qpb) {
+                if(relFillStart > barThreshold && relFillStart < relPosition && relFillStart < barTicks) {
                     // DBG("Fill-in has a short bar; starting fill-in now");
                     eraseFrontSequence();
                     continue;
@@ -239,80 +443,43 @@ void Player::tick(int sampleCount)
                 if (relFillStart > barThreshold) {
                     // DBG("Fill-in has a short bar; skipping the first fill bar");
                     eraseFrontSequence();
-                    movePosition(currentBeat->quartersPerBar);
+                    movePosition(barTicks);
                     continue;
                 }
             }
         }
 
-        if (noteIt->timestamp > blockEnd) {
+        const int64_t onTick = current->onTicks[noteIndex];
+        if (onTick > blockEnd) {
             position = blockEnd;
+            cursor = noteIndex;
             break;
         }
 
+        const uint8_t number = current->numbers[noteIndex];
+        const float velocity = current->velocities[noteIndex];
+
 #if 0
         DBG("Seq: " << queuedSequences.size()
             << " | Pos/BlockEnd: " << position << "/" << blockEnd
-            << " | current note (index/number/time/duration) : "
-            << std::distance(queuedSequences.front()->begin(), noteIt) << "/"
-            << +noteIt->number << "/" << noteIt->timestamp << "/" << noteIt->duration);
+            << " | current note (index/number/tick) : "
+            << noteIndex << "/" << +number << "/" << onTick);
 #endif
 
-        const int noteOnDelay = midiDelay(noteIt->timestamp);
-        const int noteOffDelay = midiDelay(noteIt->timestamp + noteIt->duration);
-        const auto potentialMergeIt = std::find_if(
-            potentialNotesToMerge.begin(),
-            potentialNotesToMerge.end(),
-            [&](const NoteEvents& evt) -> bool { return evt.number == noteIt->number; }
-        );
-
-        const auto deferNote = [&] {
-            deferredNotes.push_back({ noteOnDelay, noteIt->number, noteIt->velocity });
-            deferredNotes.push_back({ noteOffDelay, noteIt->number, 0.0f });
-        };
-        
-        if (potentialMergeIt == potentialNotesToMerge.end()) {
-            deferNote();
-            potentialNotesToMerge.push_back({ noteOnDelay, noteIt->number, noteIt->velocity });
+        const int noteOnDelay = midiDelay(onTick);
+        const int noteOffDelay = midiDelay(current->offTicks[noteIndex]);
+        auto& lastOnset = lastOnsets[number & 0x7F];
+        const int64_t onset = sampleClock + noteOnDelay;
+        if (!lastOnset.valid || onset - lastOnset.onset > mergingThreshold) {
+            if (!deferredNotes.pushNote(noteOnDelay, noteOffDelay, number, velocity))
+                droppedNotes.fetch_add(1, std::memory_order_relaxed);
         } else {
-            if (noteOnDelay - potentialMergeIt->delay > mergingThreshold) {
-                deferNote();
-            } else {
-                // DBG("Merging note with number " << +noteIt->number);
-            }
-    
-            potentialMergeIt->delay = noteOnDelay;
+            // DBG("Merging note with number " << +number);
         }
+        lastOnset = { onset, true };
 
-        position = noteIt->timestamp;
-        noteIt++;
-    }
-
-    std::sort(deferredNotes.begin(), deferredNotes.end(), [](const NoteEvents& lhs, const NoteEvents& rhs) {
-        return lhs.delay < rhs.delay;
-    });
-
-    auto deferredIt = deferredNotes.begin();
-    while (deferredIt != deferredNotes.end() && deferredIt->delay < sampleCount) {
-        float velocity = clamp(deferredIt->velocity, 0.0f, 1.0f);
-        noteCallback(deferredIt->delay, deferredIt->number, velocity);
-        deferredIt++;
-    }
-
-    deferredNotes.erase(deferredNotes.begin(), deferredIt);
-
-    for (auto& evt : deferredNotes)
-        evt.delay -= sampleCount;
-
-    auto potentialMergeIt = potentialNotesToMerge.begin();
-    while (potentialMergeIt != potentialNotesToMerge.end()) {
-        potentialMergeIt->delay -= sampleCount;
-
-        if (-potentialMergeIt->delay > mergingThreshold) {
-            potentialMergeIt = potentialNotesToMerge.erase(potentialMergeIt);
-        } else {
-            potentialMergeIt++;
-        }
+        position = onTick;
+        noteIndex++;
     }
 }
 
@@ -333,13 +500,64 @@ bool Player::leavingFillInState() const
 
 void Player::setSampleRate(double sampleRate)
 {
-    this->sampleRate = sampleRate;
-    mergingThreshold = quarterToSamples(mergingQuarterFraction);
+    requestedSampleRate.store(sampleRate);
 }
 
 void Player::setTempo(double bpm)
 {
-    this->secondsPerQuarter = 60.0 / bpm;
+    requestedTempo.store(bpm);
+}
+
+bool Player::isGliding() const noexcept
+{
+    return nextBeat && nextTempoChange == TempoChange::Glide && requestedTempo.load() == glideRequestedTempo;
+}
+
+void Player::applyRequestedTempo() noexcept
+{
+    if (!isGliding()) {
+        applyTempo(requestedTempo.load());
+        return;
+    }
+
+    // The tempo holds until the switch is armed, then moves linearly with the
+    // position towards the switch; it is updated once per block
+    if (!switchArmed)
+        return;
+
+    const double remaining = glideTicks > 0 ? static_cast<double>(switchTick - position) / glideTicks : 0.0;
+    const double progress = 1.0 - clamp(remaining, 0.0, 1.0);
+    applyTempo(glideStartTempo + (nextBeat->bpm - glideStartTempo) * progress);
+}
+
+void Player::applyRequestedSampleRate() noexcept
+{
+    const double requested = requestedSampleRate.load();
+    if (requested == sampleRate)
+        return;
+
+    sampleRate = requested;
+    updateTickRates();
+}
+
+void Player::applyTempo(double bpm) noexcept
+{
+    const double secondsPerQuarter = 60.0 / bpm;
+    if (secondsPerQuarter == this->secondsPerQuarter)
+        return;
+
+    this->secondsPerQuarter = secondsPerQuarter;
+    updateTickRates();
+}
+
+void Player::updateTickRates() noexcept
+{
+    const auto tempo = std::max<int64_t>(std::llround(60.0 * tempoResolution / secondsPerQuarter), 1);
+    const auto rate = std::max<int64_t>(std::llround(sampleRate), 1);
+    const auto den = (60 * tempoResolution / tickRateDivisor) * rate;
+    tickRemainder = tickRemainder * den / tickRateDen;
+    tickRateNum = (ticksPerQuarter / tickRateDivisor) * tempo;
+    tickRateDen = den;
     mergingThreshold = quarterToSamples(mergingQuarterFraction);
 }
 
@@ -350,24 +568,21 @@ void Player::setNoteCallback(NoteCallback cb)
 
 const char* Player::getCurrentPartName()
 {
-    if (!currentBeat)
+    const auto beat = publishedBeat.load();
+    if (!beat)
         return {};
 
-    return currentBeat->parts[partIndex].name.c_str();
-}
+    const auto index = static_cast<std::size_t>(partIndex);
+    if (index >= beat->parts.size())
+        return {};
 
-void Player::allOff()
-{
-    const std::unique_lock<std::mutex> lock { callbackGuard };
-    reset();
+    return beat->parts[index].name.c_str();
 }
 
-double Player::totalDuration(const Sequence& sequence)
+void Player::allOff()
 {
-    if (sequence.empty())
-        return 0.0;
-
-    return std::ceil(sequence.back().timestamp);
+    resetRequested.store(true);
+    waitForTick();
 }
 
 bool Player::isPlaying() const
@@ -380,9 +595,20 @@ int Player::quarterToSamples(double quarterFraction) const noexcept
     return static_cast<int>(quarterFraction * secondsPerQuarter * sampleRate);
 }
 
-double Player::samplesToQuarter(int samples) const noexcept
+int Player::ticksToSamples(int64_t ticks, int64_t remainder) const noexcept
 {
-    return static_cast<double>(samples) / sampleRate / secondsPerQuarter;
+    // Sample at which the timeline, starting `remainder` past a tick, moves
+    // by `ticks`; rounded down like any other time in samples.
+    const int64_t num = ticks * tickRateDen - remainder;
+    const int64_t samples = num / tickRateNum;
+    return static_cast<int>(num < 0 && samples * tickRateNum != num ? samples - 1 : samples);
+}
+
+int64_t Player::samplesToTicks(int samples) noexcept
+{
+    const int64_t num = samples * tickRateNum + tickRemainder;
+    tickRemainder = num % tickRateDen;
+    return num / tickRateDen;
 }
 
 Player::State Player::getState() const noexcept
@@ -392,11 +618,13 @@ Player::State Player::getState() const noexcept
 
 double Player::getBarPosition() const noexcept
 {
-    if (!currentBeat)
+    const auto beat = publishedBeat.load();
+    if (!beat)
         return {};   
 
-    return std::fmod(this->position * 4.0 / currentBeat->signature.denom, 
-        static_cast<double>(currentBeat->signature.num));
+    const double quarters = static_cast<double>(position) / ticksPerQuarter;
+    return std::fmod(quarters * 4.0 / beat->signature.denom, 
+        static_cast<double>(beat->signature.num));
 }
 
 int Player::getPartIndex() const noexcept
@@ -409,17 +637,12 @@ int Player::getFillIndex() const noexcept
     return fillIndex;
 }
 
-void Player::suspendCallback() noexcept
-{
-    callbackGuard.lock();
-}
-
-void Player::resumeCallback() noexcept
+uint64_t Player::getDroppedNotes() const noexcept
 {
-    callbackGuard.unlock();
+    return droppedNotes.load(std::memory_order_relaxed);
 }
 
-const Sequence* Player::getCurrentSequence() const noexcept
+const PlaybackSequence* Player::getCurrentSequence() const noexcept
 {
     if (queuedSequences.size() == 0)
         return {};
@@ -429,7 +652,7 @@ const Sequence* Player::getCurrentSequence() const noexcept
 
 double Player::getSequencePosition() const noexcept
 {
-    return this->position;
+    return static_cast<double>(position) / ticksPerQuarter;
 }
 
 
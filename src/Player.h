@@ -1,25 +1,91 @@
 #pragma once
 #include "BeatDescription.h"
+#include "NoteQueue.h"
 #include "atomic_queue/atomic_queue.h"
+#include <array>
 #include <atomic>
-#include <mutex>
+#include <functional>
+#include <limits>
 
 namespace batteur {
 
 using NoteCallback = std::function<void(int, uint8_t, float)>;
 
+struct NoteEvent {
+    int delay;
+    uint8_t number;
+    float velocity; // 0 for a note-off
+};
+
+/**
+ * @brief Plays beat descriptions.
+ *
+ * `tick` is meant to be called from the audio thread and never blocks nor
+ * allocates. Loading a beat, setting the tempo or the sample rate and `allOff`
+ * can happen from another thread: they publish their change atomically and
+ * the audio thread applies it at the start of its next tick. Loading and
+ * `allOff` wait for a tick that is already running to finish, so that a
+ * previously loaded beat can be freed as soon as they return.
+ */
 class Player {
 public:
     Player();
     bool loadBeatDescription(const BeatDescription& description);
-    const BeatDescription* getBeatDescription() { return currentBeat; }
-    const Sequence* getCurrentSequence() const noexcept;
-    double getTempo() { return 60.0 / secondsPerQuarter; }
-    bool start();
-    bool stop();
-    bool fillIn();
-    bool next();
+    const BeatDescription* getBeatDescription() { return publishedBeat.load(); }
+    enum class SwitchPoint { NextBar, EndOfPart };
+    enum class TempoChange { Keep, Glide };
+    /**
+     * @brief Queue a beat to take over from the current one without stopping.
+     * It starts with the loop of its first part, either at the next bar line or
+     * when the loop of the current part ends without a fill or a part change
+     * pending. A player that is stopped switches right away, and one that is
+     * ending switches once stopped. With `TempoChange::Glide`, the tempo moves
+     * from its current value to the bpm of the new beat, and reaches it at the
+     * switch; a tempo set in the meantime stops the glide.
+     *
+     * The player only reads the description when it switches, on the audio
+     * thread. The current beat is in use until `getBeatDescription` returns the
+     * queued one; queuing another beat replaces the queued one, which is no
+     * longer used when this returns unless it became the current beat.
+     */
+    bool queueBeatDescription(const BeatDescription& description,
+        SwitchPoint switchPoint = SwitchPoint::NextBar, TempoChange tempoChange = TempoChange::Keep);
+    /**
+     * @brief Drop the queued beat, if any. The same remarks as for
+     * `queueBeatDescription` apply to the dropped beat.
+     */
+    void cancelQueuedBeat();
+    const BeatDescription* getQueuedBeatDescription() { return queuedBeat.load(); }
+    const PlaybackSequence* getCurrentSequence() const noexcept;
+    double getTempo() { return requestedTempo.load(); }
+    /**
+     * @brief Transport commands. They are applied by the audio thread at
+     * `frame` samples from the start of the next rendered block; frames past
+     * the end of that block carry over to the following ones, so that the
+     * outcome does not depend on the block size.
+     *
+     * @return false if the command queue is full
+     */
+    bool start(int frame = 0);
+    bool stop(int frame = 0);
+    bool fillIn(int frame = 0);
+    bool next(int frame = 0);
     void tick(int sampleCount);
+    /**
+     * @brief Render a block into a caller-owned array instead of calling the
+     * note callback. Events that do not fit are kept and returned at the start
+     * of the next block, with a delay of 0.
+     *
+     * @return the number of events written
+     */
+    int tick(int sampleCount, NoteEvent* events, int capacity);
+    /**
+     * @brief Render a block and hand each event to `sink(delay, number, velocity)`.
+     * The sink is a template parameter so that it can be inlined in the render
+     * loop; `tick(sampleCount)` is the instantiation for the note callback.
+     */
+    template <class Sink>
+    void tick(int sampleCount, Sink&& sink);
     bool isPlaying() const;
     void allOff();
     void setSampleRate(double sampleRate);
@@ -32,49 +98,153 @@ public:
     double getSequencePosition() const noexcept;
     int getPartIndex() const noexcept;
     int getFillIndex() const noexcept;
-    void suspendCallback() noexcept;
-    void resumeCallback() noexcept;
+    /**
+     * @brief Number of notes dropped by the audio thread because the queue of
+     * deferred notes was full. Can be read from any thread.
+     */
+    uint64_t getDroppedNotes() const noexcept;
 private:
-    struct NoteEvents {
-        int delay;
-        uint8_t number;
-        float velocity;
+    struct MergeSlot {
+        int64_t onset; // In samples, on the player clock
+        bool valid;
     };
 
-    void updateState();
+    void schedule(int sampleCount);
+    void scheduleNotes(int offset, int sampleCount);
+    void pullCommands() noexcept;
+    template <class Sink>
+    int emit(int sampleCount, Sink& sink, int maxEvents);
+
+    // Marks the audio thread as being inside a tick: the counter is odd during
+    // the tick and even outside of it. Only the audio thread writes it; entering
+    // needs a full barrier so that the loads of published changes that follow
+    // cannot be reordered before it.
+    struct TickEpochGuard {
+        explicit TickEpochGuard(std::atomic<uint64_t>& epoch) noexcept
+        : epoch(epoch) { epoch.store(epoch.load(std::memory_order_relaxed) + 1); }
+        ~TickEpochGuard() noexcept
+        {
+            epoch.store(epoch.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+        std::atomic<uint64_t>& epoch;
+    };
     void _start();
     void _stop();
     void _fillIn();
     void _next();
 
     void reset();
+    void waitForTick() const noexcept;
+    void pickQueuedBeat() noexcept;
+    void armSwitch() noexcept;
+    void takeOverNextBeat() noexcept;
 
     enum class Message { Start = 1, Stop, Fill, Next };
+    struct Command {
+        Message message;
+        int frame; // From the start of the next block
+    };
+    void applyCommand(Message message);
     State state { State::Stopped };
     template<class T, unsigned N>
-    using spsc_queue = atomic_queue::AtomicQueue<T, N, T{}, false, false, false, true>;
-    spsc_queue<Message, 32> messages;
-    static double totalDuration(const Sequence& sequence);
+    using spsc_queue = atomic_queue::AtomicQueue2<T, N, false, false, false, true>;
+    static constexpr unsigned maxCommands { 32 };
+    spsc_queue<Command, maxCommands> messages;
+    // Commands popped from the queue, sorted by frame, that are not due yet
+    std::array<Command, maxCommands> pendingCommands;
+    unsigned numPendingCommands { 0 };
     bool enteringFillInState() const;
     bool enteringEndingState() const;
     bool leavingFillInState() const;
-    const BeatDescription* currentBeat { nullptr };
-    double position { 0.0 };
-    std::vector<const Sequence*> queuedSequences;
-    std::vector<NoteEvents> deferredNotes;
+    const BeatDescription* currentBeat { nullptr }; // Only used by the audio thread
+    std::atomic<const BeatDescription*> publishedBeat { nullptr };
+    std::atomic<const BeatDescription*> pendingBeat { nullptr };
+    std::atomic<bool> resetRequested { false };
+    std::atomic<const BeatDescription*> queuedBeat { nullptr };
+    std::atomic<SwitchPoint> queuedSwitchPoint { SwitchPoint::NextBar };
+    std::atomic<TempoChange> queuedTempoChange { TempoChange::Keep };
+    std::atomic<double> queuedRequestedTempo { 120.0 };
+    std::atomic<uint64_t> tickEpoch { 0 };
+    int64_t position { 0 }; // In ticks, within the front sequence
+    int64_t tickRemainder { 0 }; // Fraction of a tick, over tickRateDen
+    std::vector<const PlaybackSequence*> queuedSequences;
+    std::size_t cursor { 0 }; // Index of the next note to play in the front sequence
+    static constexpr unsigned maxDeferredEvents { 1024 };
+    NoteQueue<maxDeferredEvents> deferredNotes;
+    std::atomic<uint64_t> droppedNotes { 0 };
     NoteCallback noteCallback {};
+    std::atomic<double> requestedTempo { 120.0 };
     double secondsPerQuarter { 0.5 };
+    std::atomic<double> requestedSampleRate { 48e3 };
     double sampleRate { 48e3 };
     int fillIndex { 0 };
     int partIndex { 0 };
-    std::mutex callbackGuard;
 
+    // The queued beat, as seen by the audio thread. Once armed, the switch
+    // happens at switchTick, in the same ticks as the position, which are moved
+    // along with it.
+    const BeatDescription* nextBeat { nullptr };
+    SwitchPoint nextSwitchPoint { SwitchPoint::NextBar };
+    TempoChange nextTempoChange { TempoChange::Keep };
+    bool switchArmed { false };
+    int64_t switchTick { 0 };
+    double glideRequestedTempo { 120.0 }; // The requested tempo when the beat was queued
+    double glideStartTempo { 120.0 };
+    int64_t glideTicks { 0 };
+
+    // The timeline moves by exactly tickRateNum / tickRateDen ticks per sample,
+    // with the tempo rounded to a millionth of a bpm and the sample rate to a
+    // whole number of Hz. The position and its remainder are integers, so that
+    // the player keeps in phase with the host however long it plays.
+    static constexpr int64_t tempoResolution { 1000000 };
+    static constexpr int64_t tickRateDivisor { 19200 }; // gcd(ticksPerQuarter, 60 * tempoResolution)
+    static_assert(ticksPerQuarter % tickRateDivisor == 0, "");
+    static_assert(60 * tempoResolution % tickRateDivisor == 0, "");
+    int64_t tickRateNum { 1 };
+    int64_t tickRateDen { 1 };
+    void updateTickRates() noexcept;
+    void applyRequestedSampleRate() noexcept;
+    void applyRequestedTempo() noexcept;
+    void applyTempo(double bpm) noexcept;
+    bool isGliding() const noexcept;
     int quarterToSamples(double quarterFraction) const noexcept;
-    double samplesToQuarter(int samples) const noexcept;
+    int ticksToSamples(int64_t ticks, int64_t remainder) const noexcept;
+    int64_t samplesToTicks(int samples) noexcept;
+
+    // How close to the end of a bar a fill-in is deferred to the next bar
+    static constexpr int64_t fillThresholdTicks { 7 * ticksPerQuarter / 10 };
 
+    // Notes with the same number closer than this are merged into one. The
+    // table holds the last onset of each note number on a sample clock that
+    // moves forward with each processed block; old onsets are simply too far
+    // from new notes to merge, so the table never needs to be swept.
     static constexpr double mergingQuarterFraction { 0.05 };
-    std::vector<NoteEvents> potentialNotesToMerge;
+    std::array<MergeSlot, 128> lastOnsets {};
+    int64_t sampleClock { 0 };
     int mergingThreshold { static_cast<int>(mergingQuarterFraction * secondsPerQuarter * sampleRate) };
 };
 
-}
\ No newline at end of file
+template <class Sink>
+void Player::tick(int sampleCount, Sink&& sink)
+{
+    const TickEpochGuard epochGuard { tickEpoch };
+    schedule(sampleCount);
+    emit(sampleCount, sink, std::numeric_limits<int>::max());
+}
+
+template <class Sink>
+int Player::emit(int sampleCount, Sink& sink, int maxEvents)
+{
+    int count { 0 };
+    NoteQueue<maxDeferredEvents>::Event evt;
+    while (count < maxEvents && deferredNotes.pop(sampleCount, evt)) {
+        sink(evt.delay < 0 ? 0 : evt.delay, evt.number, evt.velocity);
+        count++;
+    }
+
+    deferredNotes.advance(sampleCount);
+    sampleClock += sampleCount;
+    return count;
+}
+
+}
@@ -0,0 +1,213 @@
+#include "Setlist.h"
+#include "BinaryBeat.h"
+#include "json.hpp"
+#include <cstring>
+#include <map>
+
+using nlohmann::json;
+
+namespace {
+
+struct SetlistErrorCategory : std::error_category {
+    const char* name() const noexcept override;
+    std::string message(int ev) const override;
+};
+
+const char* SetlistErrorCategory::name() const noexcept
+{
+    return "setlists";
+}
+
+std::string SetlistErrorCategory::message(int ev) const
+{
+    switch (static_cast<batteur::SetlistError>(ev)) {
+    case batteur::SetlistError::NoSongs:
+        return "No songs found in the setlist";
+
+    case batteur::SetlistError::InvalidSong:
+        return "A song has no beat file or an invalid tempo";
+
+    default:
+        return "Unknown error";
+    }
+}
+
+const SetlistErrorCategory setlistErrorCategory {};
+
+}
+
+std::error_code batteur::make_error_code(batteur::SetlistError e)
+{
+    return { static_cast<int>(e), setlistErrorCategory };
+}
+
+namespace batteur {
+
+namespace {
+
+class Arena : public BeatStorage {
+public:
+    explicit Arena(std::size_t size)
+    : words((size + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0), bytes(size) {}
+    const uint8_t* data() const noexcept final { return reinterpret_cast<const uint8_t*>(words.data()); }
+    uint8_t* data() noexcept { return reinterpret_cast<uint8_t*>(words.data()); }
+    std::size_t size() const noexcept final { return bytes; }
+private:
+    std::vector<uint64_t> words; // Keeps the data aligned
+    std::size_t bytes;
+};
+
+/**
+ * @brief The bytes of one beat in the arena, which it keeps alive
+ */
+class ArenaSlice : public BeatStorage {
+public:
+    ArenaSlice(std::shared_ptr<const BeatStorage> arena, std::size_t offset, std::size_t size) noexcept
+    : arena(std::move(arena)), offset(offset), bytes(size) {}
+    const uint8_t* data() const noexcept final { return arena->data() + offset; }
+    std::size_t size() const noexcept final { return bytes; }
+private:
+    std::shared_ptr<const BeatStorage> arena;
+    std::size_t offset;
+    std::size_t bytes;
+};
+
+struct SongEntry {
+    std::string name;
+    tl::optional<float> bpm;
+    std::size_t beatIndex;
+};
+
+bool readSetlist(const char* begin, const char* end, const fs::path& virtualFile,
+    std::string& title, std::vector<SongEntry>& songs, std::vector<fs::path>& beatFiles, std::error_code& error)
+{
+    const auto document = json::parse(begin, end, nullptr, false);
+    if (!document.is_object()) {
+        error = BeatDescriptionError::InvalidJson;
+        return false;
+    }
+
+    const auto name = document.find("name");
+    if (name != document.end() && name->is_string())
+        title = name->get<std::string>();
+
+    const auto list = document.find("songs");
+    if (list == document.end() || !list->is_array() || list->empty()) {
+        error = SetlistError::NoSongs;
+        return false;
+    }
+
+    const auto rootDirectory = virtualFile.parent_path();
+    std::map<std::string, std::size_t> beatIndices;
+    for (const auto& object : *list) {
+        const auto beat = object.find("beat");
+        if (!object.is_object() || beat == object.end() || !beat->is_string()) {
+            error = SetlistError::InvalidSong;
+            return false;
+        }
+
+        SongEntry song;
+        const auto songName = object.find("name");
+        if (songName != object.end() && songName->is_string())
+            song.name = songName->get<std::string>();
+
+        const auto bpm = object.find("bpm");
+        if (bpm != object.end()) {
+            if (!bpm->is_number() || bpm->get<float>() <= 0.0f) {
+                error = SetlistError::InvalidSong;
+                return false;
+            }
+            song.bpm = bpm->get<float>();
+        }
+
+        const auto file = fs::absolute(rootDirectory / beat->get<std::string>()).lexically_normal();
+        const auto inserted = beatIndices.emplace(file.string(), beatFiles.size());
+        if (inserted.second)
+            beatFiles.push_back(file);
+
+        song.beatIndex = inserted.first->second;
+        songs.push_back(std::move(song));
+    }
+
+    return true;
+}
+
+}
+
+std::unique_ptr<Setlist> Setlist::buildFromString(const fs::path& virtualFile, const std::string& string, std::error_code& error)
+{
+    std::string title;
+    std::vector<SongEntry> songs;
+    std::vector<fs::path> beatFiles;
+    if (!readSetlist(string.data(), string.data() + string.size(), virtualFile, title, songs, beatFiles, error))
+        return {};
+
+    // Read every beat, then copy their binary forms next to each other. The
+    // beats read from files are dropped once copied, which unmaps them.
+    std::vector<std::unique_ptr<BeatDescription>> beats;
+    std::vector<std::size_t> offsets;
+    std::size_t arenaSize { 0 };
+    for (const auto& file : beatFiles) {
+        auto beat = BeatDescription::buildFromFile(file, error);
+        if (!beat)
+            return {};
+
+        offsets.push_back(arenaSize);
+        arenaSize = binary::align8(arenaSize + beat->storage->size());
+        beats.push_back(std::move(beat));
+    }
+
+    auto arena = std::make_shared<Arena>(arenaSize);
+    std::vector<std::shared_ptr<const BeatStorage>> slices;
+    for (std::size_t i = 0; i < beats.size(); ++i) {
+        const auto& storage = *beats[i]->storage;
+        std::memcpy(arena->data() + offsets[i], storage.data(), storage.size());
+        slices.push_back(std::make_shared<ArenaSlice>(arena, offsets[i], storage.size()));
+    }
+    beats.clear();
+
+    auto setlist = std::unique_ptr<Setlist>(new Setlist());
+    setlist->title = std::move(title);
+    setlist->entries.resize(songs.size());
+    for (std::size_t i = 0; i < songs.size(); ++i) {
+        auto& entry = setlist->entries[i];
+        if (!bindBinaryBeat(entry.beat, slices[songs[i].beatIndex], error))
+            return {};
+
+        entry.name = songs[i].name.empty() ? entry.beat.name : std::move(songs[i].name);
+        if (songs[i].bpm)
+            entry.beat.bpm = *songs[i].bpm;
+    }
+
+    setlist->arena = std::move(arena);
+    return setlist;
+}
+
+std::unique_ptr<Setlist> Setlist::buildFromFile(const fs::path& file, std::error_code& error)
+{
+    if (!fs::exists(file)) {
+        error = BeatDescriptionError::NonexistentFile;
+        return {};
+    }
+
+    fs::ifstream inputStream { file, std::ios::binary };
+    const std::string text { std::istreambuf_iterator<char>(inputStream), std::istreambuf_iterator<char>() };
+    return buildFromString(file, text, error);
+}
+
+int Setlist::findSong(const BeatDescription* beat) const noexcept
+{
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        if (&entries[i].beat == beat)
+            return static_cast<int>(i);
+    }
+
+    return -1;
+}
+
+std::size_t Setlist::arenaSize() const noexcept
+{
+    return arena ? arena->size() : 0;
+}
+
+}
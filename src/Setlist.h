@@ -0,0 +1,79 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "BeatDescription.h"
+
+namespace batteur {
+
+/**
+ * @brief A song of a setlist. Its beat is bound to the arena of the setlist,
+ * and its tempo is the one of the song.
+ */
+struct Song {
+    std::string name;
+    BeatDescription beat;
+};
+
+/**
+ * @brief The songs of a gig, with all their beats loaded up front.
+ *
+ * A setlist is a JSON file:
+ *
+ *     {
+ *         "name": "Friday",
+ *         "songs": [
+ *             { "beat": "beats/Rock.json", "name": "Opener", "bpm": 128 },
+ *             { "beat": "beats/Funk.btb" }
+ *         ]
+ *     }
+ *
+ * Beat files are relative to the setlist. A song without a name or a tempo
+ * takes the ones of its beat. Every beat is read when the setlist is built,
+ * and the binary forms of all of them are copied one after the other into a
+ * single arena; a beat used by several songs is only stored once. Switching
+ * songs is then only a matter of handing another beat to the player, which
+ * can be done from the audio thread.
+ */
+class Setlist {
+public:
+    /**
+     * @brief Read a setlist and all its beats
+     *
+     * @return null on error, including any of the beats failing to load
+     */
+    static std::unique_ptr<Setlist> buildFromFile(const fs::path& file, std::error_code& error);
+    static std::unique_ptr<Setlist> buildFromString(const fs::path& virtualFile, const std::string& string, std::error_code& error);
+
+    const std::string& name() const noexcept { return title; }
+    const std::vector<Song>& songs() const noexcept { return entries; }
+
+    /**
+     * @brief The index of the song playing a beat, or -1 if the beat is not
+     * one of this setlist. Does not allocate.
+     */
+    int findSong(const BeatDescription* beat) const noexcept;
+
+    /**
+     * @brief The size in bytes of the arena holding the beats
+     */
+    std::size_t arenaSize() const noexcept;
+
+private:
+    std::string title;
+    std::vector<Song> entries; // Never resized once built, the player points into it
+    std::shared_ptr<const BeatStorage> arena;
+};
+
+enum class SetlistError {
+    NoSongs = 1,
+    InvalidSong
+};
+
+std::error_code make_error_code(SetlistError);
+
+}
+
+template <>
+struct std::is_error_code_enum<batteur::SetlistError> : true_type {};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #if defined BATTEUR_EXPORT_SYMBOLS
@@ -19,7 +20,14 @@ extern "C" {
 
 typedef struct batteur_beat_t batteur_beat_t;
 typedef struct batteur_player_t batteur_player_t;
+typedef struct batteur_library_t batteur_library_t;
+typedef struct batteur_setlist_t batteur_setlist_t;
 typedef void (*batteur_note_cb_t)(int delay, uint8_t number, float value, void* cbdata);
+typedef struct {
+  int delay;
+  uint8_t number;
+  float velocity;
+} batteur_event_t;
 typedef enum { 
   BATTEUR_STOPPED = 0,
   BATTEUR_INTRO,
@@ -28,10 +36,33 @@ typedef enum {
   BATTEUR_NEXT,
   BATTEUR_ENDING
 } batteur_status_t;
+typedef enum {
+  BATTEUR_SWITCH_NEXT_BAR = 0,
+  BATTEUR_SWITCH_END_OF_PART
+} batteur_switch_t;
+typedef enum {
+  BATTEUR_TEMPO_KEEP = 0,
+  BATTEUR_TEMPO_GLIDE
+} batteur_tempo_change_t;
 
 BATTEUR_EXPORTED_API  batteur_beat_t* batteur_load_beat(const char* filename);
 BATTEUR_EXPORTED_API  batteur_beat_t* batteur_load_beat_from_string(const char* filename, const char* string);
 BATTEUR_EXPORTED_API  void batteur_free_beat(batteur_beat_t* beat);
+/* Load a beat through a cache shared by the whole process: acquiring the same
+   unchanged file again returns the same beat. Acquired beats must not be modified,
+   and are given back with batteur_release_beat instead of batteur_free_beat. */
+BATTEUR_EXPORTED_API  batteur_beat_t* batteur_acquire_beat(const char* filename);
+BATTEUR_EXPORTED_API  void batteur_release_beat(batteur_beat_t* beat);
+/* Acquire a beat from a copy of its binary form, as given by batteur_get_beat_data.
+   Beats with the same bytes are shared. No file is read. */
+BATTEUR_EXPORTED_API  batteur_beat_t* batteur_acquire_beat_from_data(const void* data, size_t size);
+/* Take one more reference on an acquired beat. Returns false if the beat was not
+   acquired, or was released by all its users. */
+BATTEUR_EXPORTED_API  bool batteur_retain_beat(batteur_beat_t* beat);
+/* Point `data` to the binary form of a beat, which lives as long as the beat,
+   and return its size in bytes. It can only be read back on a machine with
+   the same byte order. */
+BATTEUR_EXPORTED_API  size_t batteur_get_beat_data(batteur_beat_t* beat, const void** data);
 BATTEUR_EXPORTED_API  const char* batteur_get_beat_name(batteur_beat_t* beat);
 BATTEUR_EXPORTED_API  const char* batteur_get_part_name(batteur_beat_t* beat, int part_index);
 BATTEUR_EXPORTED_API  int batteur_get_total_parts(batteur_beat_t* beat);
@@ -39,19 +70,69 @@ BATTEUR_EXPORTED_API  int batteur_get_total_fills(batteur_beat_t* beat, int part
 BATTEUR_EXPORTED_API  int batteur_get_time_numerator(batteur_beat_t* beat);
 BATTEUR_EXPORTED_API  int batteur_get_time_denominator(batteur_beat_t* beat);
 
+/* List the beats of a directory tree from their metadata only. If index_file is
+   not NULL, the metadata of unchanged files is taken from it, and it is updated. */
+BATTEUR_EXPORTED_API  batteur_library_t* batteur_library_scan(const char* directory, const char* index_file);
+BATTEUR_EXPORTED_API  void batteur_library_free(batteur_library_t* library);
+BATTEUR_EXPORTED_API  int batteur_library_get_total_beats(batteur_library_t* library);
+BATTEUR_EXPORTED_API  const char* batteur_library_get_file(batteur_library_t* library, int beat_index);
+BATTEUR_EXPORTED_API  const char* batteur_library_get_name(batteur_library_t* library, int beat_index);
+BATTEUR_EXPORTED_API  const char* batteur_library_get_group(batteur_library_t* library, int beat_index);
+BATTEUR_EXPORTED_API  double batteur_library_get_bpm(batteur_library_t* library, int beat_index);
+BATTEUR_EXPORTED_API  int batteur_library_get_time_numerator(batteur_library_t* library, int beat_index);
+BATTEUR_EXPORTED_API  int batteur_library_get_time_denominator(batteur_library_t* library, int beat_index);
+BATTEUR_EXPORTED_API  int batteur_library_get_total_parts(batteur_library_t* library, int beat_index);
+BATTEUR_EXPORTED_API  const char* batteur_library_get_part_name(batteur_library_t* library, int beat_index, int part_index);
+BATTEUR_EXPORTED_API  int batteur_library_get_total_fills(batteur_library_t* library, int beat_index, int part_index);
+/* Find the beats matching a group (NULL for any), an inclusive bpm range (negative
+   bounds for none) and a signature (0 for any). Up to `capacity` beat indices are
+   written to `out`, and the number of matching beats is returned. */
+BATTEUR_EXPORTED_API  int batteur_library_find(batteur_library_t* library, const char* group, double min_bpm, double max_bpm,
+                                               int time_numerator, int time_denominator, int* out, int capacity);
+/* Load a setlist and all the beats of its songs. The beats belong to the setlist:
+   they must not be freed, and the setlist must outlive any player using them. */
+BATTEUR_EXPORTED_API  batteur_setlist_t* batteur_setlist_load(const char* filename);
+BATTEUR_EXPORTED_API  void batteur_setlist_free(batteur_setlist_t* setlist);
+BATTEUR_EXPORTED_API  const char* batteur_setlist_get_name(batteur_setlist_t* setlist);
+BATTEUR_EXPORTED_API  int batteur_setlist_get_total_songs(batteur_setlist_t* setlist);
+BATTEUR_EXPORTED_API  const char* batteur_setlist_get_song_name(batteur_setlist_t* setlist, int song_index);
+BATTEUR_EXPORTED_API  double batteur_setlist_get_song_bpm(batteur_setlist_t* setlist, int song_index);
+BATTEUR_EXPORTED_API  batteur_beat_t* batteur_setlist_get_beat(batteur_setlist_t* setlist, int song_index);
+/* The index of the song whose beat this is, or -1 if the beat is not from this setlist */
+BATTEUR_EXPORTED_API  int batteur_setlist_find_song(batteur_setlist_t* setlist, batteur_beat_t* beat);
+/* Switch the player to a song: its beat is loaded if the player is stopped, and
+   queued otherwise. This does no I/O nor allocation and can be called from the
+   audio thread, between ticks. */
+BATTEUR_EXPORTED_API  bool batteur_setlist_play_song(batteur_setlist_t* setlist, int song_index, batteur_player_t* player,
+                                                     batteur_switch_t switch_point, batteur_tempo_change_t tempo_change);
+
 BATTEUR_EXPORTED_API  batteur_player_t* batteur_new();
 BATTEUR_EXPORTED_API  void batteur_free(batteur_player_t* player);
 BATTEUR_EXPORTED_API  bool batteur_load(batteur_player_t* player, batteur_beat_t* beat);
+/* Queue a beat that takes over at the next bar or at the end of the current part,
+   without stopping. The current beat stays in use until batteur_get_current_beat
+   returns the queued one. A queued beat that is replaced or cancelled is no longer
+   used when these functions return, unless it became the current beat. */
+BATTEUR_EXPORTED_API  bool batteur_queue(batteur_player_t* player, batteur_beat_t* beat,
+                                         batteur_switch_t switch_point, batteur_tempo_change_t tempo_change);
+BATTEUR_EXPORTED_API  void batteur_cancel_queued(batteur_player_t* player);
+BATTEUR_EXPORTED_API  batteur_beat_t* batteur_get_queued_beat(batteur_player_t* player);
 BATTEUR_EXPORTED_API  void batteur_set_sample_rate(batteur_player_t* player, double sample_rate);
 BATTEUR_EXPORTED_API  void batteur_note_cb(batteur_player_t* player, batteur_note_cb_t callback, void* cbdata);
 BATTEUR_EXPORTED_API  void batteur_set_tempo(batteur_player_t* player, double bpm);
 BATTEUR_EXPORTED_API  double batteur_get_tempo(batteur_player_t* player);
 BATTEUR_EXPORTED_API  batteur_beat_t* batteur_get_current_beat(batteur_player_t* player);
 BATTEUR_EXPORTED_API  void batteur_tick(batteur_player_t* player, int sample_count);
+BATTEUR_EXPORTED_API  int batteur_tick_into(batteur_player_t* player, int sample_count, batteur_event_t* out, int capacity);
 BATTEUR_EXPORTED_API  void batteur_fill_in(batteur_player_t* player);
 BATTEUR_EXPORTED_API  void batteur_next(batteur_player_t* player);
 BATTEUR_EXPORTED_API  void batteur_stop(batteur_player_t* player);
 BATTEUR_EXPORTED_API  void batteur_start(batteur_player_t* player);
+/* Same as above, applied `frame` samples after the start of the next tick */
+BATTEUR_EXPORTED_API  void batteur_fill_in_at(batteur_player_t* player, int frame);
+BATTEUR_EXPORTED_API  void batteur_next_at(batteur_player_t* player, int frame);
+BATTEUR_EXPORTED_API  void batteur_stop_at(batteur_player_t* player, int frame);
+BATTEUR_EXPORTED_API  void batteur_start_at(batteur_player_t* player, int frame);
 BATTEUR_EXPORTED_API  void batteur_all_off(batteur_player_t* player);
 BATTEUR_EXPORTED_API  bool batteur_playing(batteur_player_t* player);
 BATTEUR_EXPORTED_API  batteur_status_t batteur_get_status(batteur_player_t* player);
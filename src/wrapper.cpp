@@ -1,6 +1,53 @@
 #include "batteur.h"
+#include "BeatCache.h"
 #include "BeatDescription.h"
+#include "BeatLibrary.h"
+#include "BinaryBeat.h"
 #include "Player.h"
+#include "Setlist.h"
+#include <cstddef>
+
+static_assert(sizeof(batteur_event_t) == sizeof(batteur::NoteEvent), "Event layouts must match");
+static_assert(offsetof(batteur_event_t, delay) == offsetof(batteur::NoteEvent, delay), "Event layouts must match");
+static_assert(offsetof(batteur_event_t, number) == offsetof(batteur::NoteEvent, number), "Event layouts must match");
+static_assert(offsetof(batteur_event_t, velocity) == offsetof(batteur::NoteEvent, velocity), "Event layouts must match");
+
+namespace {
+
+const batteur::BeatInfo* getLibraryBeat(batteur_library_t* library, int beat_index)
+{
+    if (!library)
+        return {};
+
+    const auto& beats = reinterpret_cast<batteur::BeatLibrary*>(library)->beats();
+    if (beat_index < 0 || beat_index >= static_cast<int>(beats.size()))
+        return {};
+
+    return &beats[beat_index];
+}
+
+const batteur::PartInfo* getLibraryPart(batteur_library_t* library, int beat_index, int part_index)
+{
+    const auto beat = getLibraryBeat(library, beat_index);
+    if (!beat || part_index < 0 || part_index >= static_cast<int>(beat->parts.size()))
+        return {};
+
+    return &beat->parts[part_index];
+}
+
+const batteur::Song* getSetlistSong(batteur_setlist_t* setlist, int song_index)
+{
+    if (!setlist)
+        return {};
+
+    const auto& songs = reinterpret_cast<batteur::Setlist*>(setlist)->songs();
+    if (song_index < 0 || song_index >= static_cast<int>(songs.size()))
+        return {};
+
+    return &songs[song_index];
+}
+
+}
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,6 +78,53 @@ void batteur_free_beat(batteur_beat_t* beat)
     delete reinterpret_cast<batteur::BeatDescription*>(beat);
 }
 
+batteur_beat_t* batteur_acquire_beat(const char* filename)
+{
+    std::error_code ec;
+    auto beat = batteur::acquireBeat(filename, ec);
+    if (ec)
+        return NULL;
+
+    return reinterpret_cast<batteur_beat_t*>(const_cast<batteur::BeatDescription*>(beat));
+}
+
+void batteur_release_beat(batteur_beat_t* beat)
+{
+    batteur::releaseBeat(reinterpret_cast<batteur::BeatDescription*>(beat));
+}
+
+batteur_beat_t* batteur_acquire_beat_from_data(const void* data, size_t size)
+{
+    std::error_code ec;
+    auto beat = batteur::acquireBeatData(data, size, ec);
+    if (ec)
+        return NULL;
+
+    return reinterpret_cast<batteur_beat_t*>(const_cast<batteur::BeatDescription*>(beat));
+}
+
+bool batteur_retain_beat(batteur_beat_t* beat)
+{
+    if (!beat)
+        return false;
+
+    return batteur::retainBeat(reinterpret_cast<batteur::BeatDescription*>(beat));
+}
+
+size_t batteur_get_beat_data(batteur_beat_t* beat, const void** data)
+{
+    auto self = reinterpret_cast<batteur::BeatDescription*>(beat);
+    if (!self || !self->storage) {
+        if (data)
+            *data = NULL;
+        return 0;
+    }
+
+    if (data)
+        *data = self->storage->data();
+    return self->storage->size();
+}
+
 const char* batteur_get_beat_name(batteur_beat_t* beat)
 {
     if (!beat)
@@ -72,7 +166,7 @@ int batteur_get_total_fills(batteur_beat_t* beat, int part_index)
     if (part_index < 0 || part_index >= numParts)
         return 0;
 
-    return static_cast<int>(self->parts[part_index].fills.size());
+    return static_cast<int>(self->playback.parts[part_index].fills.size());
 }
 
 int batteur_get_time_numerator(batteur_beat_t* beat)
@@ -93,7 +187,182 @@ int batteur_get_time_denominator(batteur_beat_t* beat)
     return self->signature.denom;
 }
 
+batteur_library_t* batteur_library_scan(const char* directory, const char* index_file)
+{
+    std::error_code ec;
+    auto library = batteur::BeatLibrary::scan(directory, index_file ? index_file : fs::path {}, ec);
+    if (ec)
+        return NULL;
+
+    return reinterpret_cast<batteur_library_t*>(library.release());
+}
+
+void batteur_library_free(batteur_library_t* library)
+{
+    delete reinterpret_cast<batteur::BeatLibrary*>(library);
+}
+
+int batteur_library_get_total_beats(batteur_library_t* library)
+{
+    if (!library)
+        return 0;
+
+    auto self = reinterpret_cast<batteur::BeatLibrary*>(library);
+    return static_cast<int>(self->beats().size());
+}
+
+const char* batteur_library_get_file(batteur_library_t* library, int beat_index)
+{
+    const auto beat = getLibraryBeat(library, beat_index);
+    return beat ? beat->file.c_str() : nullptr;
+}
+
+const char* batteur_library_get_name(batteur_library_t* library, int beat_index)
+{
+    const auto beat = getLibraryBeat(library, beat_index);
+    return beat ? beat->name.c_str() : nullptr;
+}
+
+const char* batteur_library_get_group(batteur_library_t* library, int beat_index)
+{
+    const auto beat = getLibraryBeat(library, beat_index);
+    return beat ? beat->group.c_str() : nullptr;
+}
+
+double batteur_library_get_bpm(batteur_library_t* library, int beat_index)
+{
+    const auto beat = getLibraryBeat(library, beat_index);
+    return beat ? beat->bpm : 0.0;
+}
+
+int batteur_library_get_time_numerator(batteur_library_t* library, int beat_index)
+{
+    const auto beat = getLibraryBeat(library, beat_index);
+    return beat ? beat->signature.num : 0;
+}
+
+int batteur_library_get_time_denominator(batteur_library_t* library, int beat_index)
+{
+    const auto beat = getLibraryBeat(library, beat_index);
+    return beat ? beat->signature.denom : 0;
+}
+
+int batteur_library_get_total_parts(batteur_library_t* library, int beat_index)
+{
+    const auto beat = getLibraryBeat(library, beat_index);
+    return beat ? static_cast<int>(beat->parts.size()) : 0;
+}
+
+const char* batteur_library_get_part_name(batteur_library_t* library, int beat_index, int part_index)
+{
+    const auto part = getLibraryPart(library, beat_index, part_index);
+    return part ? part->name.c_str() : nullptr;
+}
+
+int batteur_library_get_total_fills(batteur_library_t* library, int beat_index, int part_index)
+{
+    const auto part = getLibraryPart(library, beat_index, part_index);
+    return part ? part->numFills : 0;
+}
 
+int batteur_library_find(batteur_library_t* library, const char* group, double min_bpm, double max_bpm,
+                         int time_numerator, int time_denominator, int* out, int capacity)
+{
+    if (!library)
+        return 0;
+
+    batteur::BeatQuery query;
+    if (group)
+        query.group = std::string(group);
+    if (min_bpm >= 0.0)
+        query.minBpm = static_cast<float>(min_bpm);
+    if (max_bpm >= 0.0)
+        query.maxBpm = static_cast<float>(max_bpm);
+    if (time_numerator > 0 && time_denominator > 0)
+        query.signature = batteur::TimeSignature { time_numerator, time_denominator };
+
+    auto self = reinterpret_cast<batteur::BeatLibrary*>(library);
+    const auto found = self->find(query);
+    const auto count = static_cast<int>(found.size());
+    for (int i = 0; i < count && i < capacity && out; ++i)
+        out[i] = static_cast<int>(found[i]);
+
+    return count;
+}
+
+batteur_setlist_t* batteur_setlist_load(const char* filename)
+{
+    std::error_code ec;
+    auto setlist = batteur::Setlist::buildFromFile(filename, ec);
+    if (ec)
+        return NULL;
+
+    return reinterpret_cast<batteur_setlist_t*>(setlist.release());
+}
+
+void batteur_setlist_free(batteur_setlist_t* setlist)
+{
+    delete reinterpret_cast<batteur::Setlist*>(setlist);
+}
+
+const char* batteur_setlist_get_name(batteur_setlist_t* setlist)
+{
+    if (!setlist)
+        return nullptr;
+
+    auto self = reinterpret_cast<batteur::Setlist*>(setlist);
+    return self->name().c_str();
+}
+
+int batteur_setlist_get_total_songs(batteur_setlist_t* setlist)
+{
+    if (!setlist)
+        return 0;
+
+    auto self = reinterpret_cast<batteur::Setlist*>(setlist);
+    return static_cast<int>(self->songs().size());
+}
+
+const char* batteur_setlist_get_song_name(batteur_setlist_t* setlist, int song_index)
+{
+    const auto song = getSetlistSong(setlist, song_index);
+    return song ? song->name.c_str() : nullptr;
+}
+
+double batteur_setlist_get_song_bpm(batteur_setlist_t* setlist, int song_index)
+{
+    const auto song = getSetlistSong(setlist, song_index);
+    return song ? song->beat.bpm : 0.0;
+}
+
+batteur_beat_t* batteur_setlist_get_beat(batteur_setlist_t* setlist, int song_index)
+{
+    const auto song = getSetlistSong(setlist, song_index);
+    return song ? (batteur_beat_t*)&song->beat : NULL;
+}
+
+int batteur_setlist_find_song(batteur_setlist_t* setlist, batteur_beat_t* beat)
+{
+    if (!setlist)
+        return -1;
+
+    auto self = reinterpret_cast<batteur::Setlist*>(setlist);
+    return self->findSong(reinterpret_cast<batteur::BeatDescription*>(beat));
+}
+
+bool batteur_setlist_play_song(batteur_setlist_t* setlist, int song_index, batteur_player_t* player,
+                               batteur_switch_t switch_point, batteur_tempo_change_t tempo_change)
+{
+    const auto song = getSetlistSong(setlist, song_index);
+    if (!song || !player)
+        return false;
+
+    auto beat = (batteur_beat_t*)&song->beat;
+    if (!batteur_playing(player))
+        return batteur_load(player, beat);
+
+    return batteur_queue(player, beat, switch_point, tempo_change);
+}
 
 batteur_player_t* batteur_new()
 {
@@ -115,6 +384,38 @@ bool batteur_load(batteur_player_t* player, batteur_beat_t* beat)
     return self->loadBeatDescription(*description);
 }
 
+bool batteur_queue(batteur_player_t* player, batteur_beat_t* beat,
+                   batteur_switch_t switch_point, batteur_tempo_change_t tempo_change)
+{
+    if (!player || !beat)
+        return false;
+
+    using batteur::Player;
+    auto self = reinterpret_cast<Player*>(player);
+    auto description = reinterpret_cast<batteur::BeatDescription*>(beat);
+    const auto switchPoint = switch_point == BATTEUR_SWITCH_END_OF_PART ? Player::SwitchPoint::EndOfPart : Player::SwitchPoint::NextBar;
+    const auto tempoChange = tempo_change == BATTEUR_TEMPO_GLIDE ? Player::TempoChange::Glide : Player::TempoChange::Keep;
+    return self->queueBeatDescription(*description, switchPoint, tempoChange);
+}
+
+void batteur_cancel_queued(batteur_player_t* player)
+{
+    if (!player)
+        return;
+
+    auto self = reinterpret_cast<batteur::Player*>(player);
+    self->cancelQueuedBeat();
+}
+
+batteur_beat_t* batteur_get_queued_beat(batteur_player_t* player)
+{
+    if (!player)
+        return NULL;
+
+    auto self = reinterpret_cast<batteur::Player*>(player);
+    return (batteur_beat_t*)self->getQueuedBeatDescription();
+}
+
 void batteur_set_sample_rate(batteur_player_t* player, double sample_rate)
 {
     if (!player)
@@ -153,6 +454,20 @@ void batteur_tick(batteur_player_t* player, int sample_count)
     self->tick(sample_count);
 }
 
+int batteur_tick_into(batteur_player_t* player, int sample_count, batteur_event_t* out, int capacity)
+{
+    if (!player)
+        return 0;
+
+    // Time still advances without room for the events, which are kept for
+    // the next blocks
+    if (!out || capacity < 0)
+        capacity = 0;
+
+    auto self = reinterpret_cast<batteur::Player*>(player);
+    return self->tick(sample_count, reinterpret_cast<batteur::NoteEvent*>(out), capacity);
+}
+
 void batteur_fill_in(batteur_player_t* player)
 {
     if (!player)
@@ -189,6 +504,42 @@ void batteur_start(batteur_player_t* player)
     self->start();
 }
 
+void batteur_fill_in_at(batteur_player_t* player, int frame)
+{
+    if (!player)
+        return;
+    
+    auto self = reinterpret_cast<batteur::Player*>(player);
+    self->fillIn(frame);
+}
+
+void batteur_next_at(batteur_player_t* player, int frame)
+{
+    if (!player)
+        return;
+    
+    auto self = reinterpret_cast<batteur::Player*>(player);
+    self->next(frame);
+}
+
+void batteur_stop_at(batteur_player_t* player, int frame)
+{
+    if (!player)
+        return;
+    
+    auto self = reinterpret_cast<batteur::Player*>(player);
+    self->stop(frame);
+}
+
+void batteur_start_at(batteur_player_t* player, int frame)
+{
+    if (!player)
+        return;
+    
+    auto self = reinterpret_cast<batteur::Player*>(player);
+    self->start(frame);
+}
+
 void batteur_all_off(batteur_player_t* player)
 {
     if (!player)
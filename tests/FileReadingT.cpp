@@ -1,5 +1,6 @@
 #include "FileReadingHelpers.h"
 #include "catch.hpp"
+#include <cmath>
 using namespace Catch::literals;
 using namespace nlohmann;
 
@@ -175,4 +176,138 @@ TEST_CASE("[Files] ReadMidiFile files")
         REQUIRE( f.value().size() == 16 );
         REQUIRE( batteur::barCount(*f, 4) == 4);
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("[Files] ReadMidiFile overlapping notes")
+{
+    // Two hits of the same snare overlap, a stray note-off has no note-on,
+    // and the hi-hat ends with a zero velocity note-on
+    auto j = R"({"filename": "overlapping.mid"})"_json;
+    const auto f = readSequence(j, fs::current_path() / "tests/files/" );
+    REQUIRE( f.has_value() );
+    REQUIRE( f->size() == 3 );
+    REQUIRE( (*f)[0].number == 38 );
+    REQUIRE( (*f)[0].timestamp == 0.0_a );
+    REQUIRE( (*f)[0].duration == 2.0_a );
+    REQUIRE( (*f)[1].number == 38 );
+    REQUIRE( (*f)[1].timestamp == 0.5_a );
+    REQUIRE( (*f)[1].duration == 0.5_a );
+    REQUIRE( (*f)[2].number == 42 );
+    REQUIRE( (*f)[2].timestamp == 3.0_a );
+    REQUIRE( (*f)[2].duration == 1.0_a );
+}
+
+TEST_CASE("[Files] ReadMidiFile exact ticks")
+{
+    // A tempo track and a note track, with notes off the grid at 97 bpm
+    auto j = R"({"filename": "ticks.mid"})"_json;
+    const auto f = readSequence(j, fs::current_path() / "tests/files/" );
+    REQUIRE( f.has_value() );
+    REQUIRE( f->size() == 3 );
+    // Exact as in on the right MIDI tick, at 480 per quarter
+    const auto ticks = [](double quarters) { return std::llround(quarters * 480); };
+    REQUIRE( ticks((*f)[0].timestamp) == 1 );
+    REQUIRE( ticks((*f)[0].duration) == 6 );
+    REQUIRE( ticks((*f)[1].timestamp) == 481 );
+    REQUIRE( ticks((*f)[1].duration) == 519 );
+    REQUIRE( ticks((*f)[2].timestamp) == 1013 );
+    REQUIRE( ticks((*f)[2].duration) == 907 );
+}
+
+TEST_CASE("[Files] ReadMidiFile tempo changes")
+{
+    SECTION("Tempo ramp")
+    {
+        // From 80 to 160 bpm over 4 bars, changing every 8th note
+        auto j = R"({"filename": "tempo_ramp.mid"})"_json;
+        const auto f = readSequence(j, fs::current_path() / "tests/files/" );
+        REQUIRE( f.has_value() );
+        REQUIRE( f->size() == 16 );
+        for (std::size_t i = 0; i < f->size(); ++i) {
+            REQUIRE( (*f)[i].timestamp == static_cast<double>(i) );
+            REQUIRE( (*f)[i].duration == 0.25 );
+        }
+    }
+
+    SECTION("Tempo ramp - Ignore 2, 1 bar")
+    {
+        auto j = R"({"filename": "tempo_ramp.mid", "ignore_bars": 2, "bars": 1})"_json;
+        const auto f = readSequence(j, fs::current_path() / "tests/files/" );
+        REQUIRE( f.has_value() );
+        REQUIRE( f->front().timestamp == 0.0 );
+        REQUIRE( f->front().number == 36 );
+        REQUIRE( batteur::barCount(*f, 4) == 1 );
+    }
+
+    SECTION("SMPTE division")
+    {
+        // 1000 ticks per second, at 120 then 60 bpm
+        auto j = R"({"filename": "smpte_tempo.mid"})"_json;
+        const auto f = readSequence(j, fs::current_path() / "tests/files/" );
+        REQUIRE( f.has_value() );
+        REQUIRE( f->size() == 5 );
+        REQUIRE( (*f)[0].timestamp == 0.0_a );
+        REQUIRE( (*f)[0].duration == 0.2_a );
+        REQUIRE( (*f)[1].timestamp == 1.0_a );
+        REQUIRE( (*f)[2].timestamp == 2.0_a );
+        REQUIRE( (*f)[2].duration == 0.1_a );
+        REQUIRE( (*f)[3].timestamp == 3.0_a );
+        REQUIRE( (*f)[4].timestamp == 4.0_a );
+    }
+}
+
+TEST_CASE("[Files] ReadMidiFile time signature changes")
+{
+    // 2 bars of 4/4, 3 bars of 3/4 and 2 bars of 7/8, with a hit on each
+    // downbeat numbered after its bar
+    const auto root = fs::current_path() / "tests/files/";
+
+    SECTION("Whole file")
+    {
+        auto j = R"({"filename": "signature_changes.mid"})"_json;
+        const auto f = readSequence(j, root);
+        REQUIRE( f.has_value() );
+        const std::vector<double> downbeats { 0.0, 4.0, 8.0, 11.0, 14.0, 17.0, 20.5 };
+        REQUIRE( f->size() == downbeats.size() );
+        for (std::size_t i = 0; i < f->size(); ++i) {
+            REQUIRE( (*f)[i].timestamp == downbeats[i] );
+            REQUIRE( (*f)[i].number == 40 + i );
+        }
+    }
+
+    SECTION("Ignore the 4/4 bars")
+    {
+        auto j = R"({"filename": "signature_changes.mid", "ignore_bars": 2})"_json;
+        const auto f = readSequence(j, root);
+        REQUIRE( f.has_value() );
+        REQUIRE( f->size() == 5 );
+        REQUIRE( f->front().number == 42 );
+        REQUIRE( f->front().timestamp == 0.0 );
+        REQUIRE( (*f)[1].timestamp == 3.0 );
+        REQUIRE( (*f)[3].timestamp == 9.0 );
+    }
+
+    SECTION("One bar of 7/8")
+    {
+        auto j = R"({"filename": "signature_changes.mid", "ignore_bars": 5, "bars": 1})"_json;
+        const auto f = readSequence(j, root);
+        REQUIRE( f.has_value() );
+        REQUIRE( f->front().number == 45 );
+        REQUIRE( f->front().timestamp == 0.0 );
+        REQUIRE( f->front().duration == 0.125 );
+        for (const auto& note : *f)
+            REQUIRE( note.timestamp <= 3.5 );
+    }
+
+    SECTION("Two bars of 3/4")
+    {
+        auto j = R"({"filename": "signature_changes.mid", "ignore_bars": 3, "bars": 2})"_json;
+        const auto f = readSequence(j, root);
+        REQUIRE( f.has_value() );
+        REQUIRE( f->front().number == 43 );
+        REQUIRE( (*f)[1].number == 44 );
+        REQUIRE( (*f)[1].timestamp == 3.0 );
+        for (const auto& note : *f)
+            REQUIRE( note.timestamp <= 6.0 );
+    }
+}
@@ -1,5 +1,22 @@
+#include "BeatCache.h"
 #include "BeatDescription.h"
+#include "BeatLibrary.h"
+#include "BinaryBeat.h"
+#include "FileReadingHelpers.h"
+#include "JsonBeatReader.h"
+#include "Setlist.h"
+#include "batteur.h"
 #include "catch.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <thread>
+#if !defined _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 using namespace Catch::literals;
 using namespace batteur;
 
@@ -345,4 +362,843 @@ TEST_CASE("[Files] Read from string 2") {
     REQUIRE( beat->parts[0].transition );
     REQUIRE( beat->parts[1].transition );
 
-}
\ No newline at end of file
+}
+
+namespace {
+
+fs::path writeBytes(const std::string& name, const uint8_t* data, std::size_t size)
+{
+    const auto path = fs::temp_directory_path() / name;
+    std::ofstream stream { path.string(), std::ios::binary | std::ios::trunc };
+    stream.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+    return path;
+}
+
+void requireSameSequence(const PlaybackSequence& lhs, const PlaybackSequence& rhs)
+{
+    REQUIRE( lhs.size() == rhs.size() );
+    REQUIRE( lhs.durationTicks == rhs.durationTicks );
+    REQUIRE( std::equal(lhs.onTicks.begin(), lhs.onTicks.end(), rhs.onTicks.begin()) );
+    REQUIRE( std::equal(lhs.offTicks.begin(), lhs.offTicks.end(), rhs.offTicks.begin()) );
+    REQUIRE( std::equal(lhs.numbers.begin(), lhs.numbers.end(), rhs.numbers.begin()) );
+    REQUIRE( std::equal(lhs.velocities.begin(), lhs.velocities.end(), rhs.velocities.begin()) );
+}
+
+}
+
+TEST_CASE("[Files] Binary beat")
+{
+    std::error_code ec;
+    auto beat = BeatDescription::buildFromFile(fs::current_path() / "tests/files/shuffle.json", ec);
+    REQUIRE( beat );
+    REQUIRE( beat->storage );
+    const auto file = writeBytes("batteur_shuffle.btb", beat->storage->data(), beat->storage->size());
+
+    auto binary = BeatDescription::buildFromFile(file, ec);
+    REQUIRE( binary );
+    REQUIRE( !ec );
+    REQUIRE( binary->name == beat->name );
+    REQUIRE( binary->group == beat->group );
+    REQUIRE( binary->bpm == beat->bpm );
+    REQUIRE( binary->quartersPerBar == beat->quartersPerBar );
+    REQUIRE( binary->signature.num == beat->signature.num );
+    REQUIRE( binary->signature.denom == beat->signature.denom );
+    REQUIRE( !binary->intro ); // Note lists are not decoded
+    REQUIRE( binary->parts.size() == 2 );
+    REQUIRE( binary->parts[0].name == "Snare" );
+    REQUIRE( binary->parts[1].name == "Ride" );
+
+    const auto& expected = beat->playback;
+    const auto& playback = binary->playback;
+    REQUIRE( playback.barTicks == expected.barTicks );
+    REQUIRE( playback.intro );
+    requireSameSequence(*playback.intro, *expected.intro);
+    REQUIRE( bool(playback.ending) == bool(expected.ending) );
+    REQUIRE( playback.parts.size() == expected.parts.size() );
+    for (std::size_t i = 0; i < playback.parts.size(); ++i) {
+        requireSameSequence(playback.parts[i].mainLoop, expected.parts[i].mainLoop);
+        REQUIRE( playback.parts[i].fills.size() == expected.parts[i].fills.size() );
+        for (std::size_t j = 0; j < playback.parts[i].fills.size(); ++j)
+            requireSameSequence(playback.parts[i].fills[j], expected.parts[i].fills[j]);
+        REQUIRE( bool(playback.parts[i].transition) == bool(expected.parts[i].transition) );
+        if (playback.parts[i].transition)
+            requireSameSequence(*playback.parts[i].transition, *expected.parts[i].transition);
+    }
+
+    // The notes are used in place
+    const auto data = binary->storage->data();
+    const auto begin = reinterpret_cast<const uint8_t*>(playback.parts[0].mainLoop.onTicks.data());
+    REQUIRE( begin > data );
+    REQUIRE( begin < data + binary->storage->size() );
+
+    binary.reset();
+    fs::remove(file);
+}
+
+TEST_CASE("[Files] Corrupted binary beats")
+{
+    std::error_code ec;
+    auto beat = BeatDescription::buildFromFile(fs::current_path() / "tests/files/shuffle.json", ec);
+    REQUIRE( beat );
+    std::vector<uint8_t> bytes { beat->storage->data(), beat->storage->data() + beat->storage->size() };
+
+    SECTION("Truncated")
+    {
+        const auto file = writeBytes("batteur_truncated.btb", bytes.data(), bytes.size() / 2);
+        REQUIRE( !BeatDescription::buildFromFile(file, ec) );
+        REQUIRE( ec == BeatDescriptionError::InvalidBinaryFile );
+        fs::remove(file);
+    }
+
+    SECTION("Wrong version")
+    {
+        const uint32_t version { binary::version + 1 };
+        std::memcpy(&bytes[offsetof(binary::Header, version)], &version, sizeof(version));
+        const auto file = writeBytes("batteur_version.btb", bytes.data(), bytes.size());
+        REQUIRE( !BeatDescription::buildFromFile(file, ec) );
+        REQUIRE( ec == BeatDescriptionError::UnsupportedBinaryVersion );
+        fs::remove(file);
+    }
+
+    SECTION("Sequence out of bounds")
+    {
+        const uint32_t intro { 1000 };
+        std::memcpy(&bytes[offsetof(binary::Header, intro)], &intro, sizeof(intro));
+        const auto file = writeBytes("batteur_bounds.btb", bytes.data(), bytes.size());
+        REQUIRE( !BeatDescription::buildFromFile(file, ec) );
+        REQUIRE( ec == BeatDescriptionError::InvalidBinaryFile );
+        fs::remove(file);
+    }
+}
+
+namespace {
+
+std::string readText(const fs::path& file)
+{
+    std::ifstream stream { file.string(), std::ios::binary };
+    return { std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>() };
+}
+
+void requireSameNotes(const Sequence& lhs, const Sequence& rhs)
+{
+    REQUIRE( lhs.size() == rhs.size() );
+    for (std::size_t i = 0; i < lhs.size(); ++i) {
+        REQUIRE( lhs[i].timestamp == rhs[i].timestamp );
+        REQUIRE( lhs[i].duration == rhs[i].duration );
+        REQUIRE( lhs[i].number == rhs[i].number );
+        REQUIRE( lhs[i].velocity == rhs[i].velocity );
+    }
+}
+
+void requireSameDescription(const BeatDescription& lhs, const BeatDescription& rhs)
+{
+    REQUIRE( lhs.name == rhs.name );
+    REQUIRE( lhs.group == rhs.group );
+    REQUIRE( lhs.bpm == rhs.bpm );
+    REQUIRE( lhs.quartersPerBar == rhs.quartersPerBar );
+    REQUIRE( lhs.signature.num == rhs.signature.num );
+    REQUIRE( lhs.signature.denom == rhs.signature.denom );
+    REQUIRE( bool(lhs.intro) == bool(rhs.intro) );
+    if (lhs.intro)
+        requireSameNotes(*lhs.intro, *rhs.intro);
+    REQUIRE( bool(lhs.ending) == bool(rhs.ending) );
+    if (lhs.ending)
+        requireSameNotes(*lhs.ending, *rhs.ending);
+    REQUIRE( lhs.parts.size() == rhs.parts.size() );
+    for (std::size_t i = 0; i < lhs.parts.size(); ++i) {
+        REQUIRE( lhs.parts[i].name == rhs.parts[i].name );
+        requireSameNotes(lhs.parts[i].mainLoop, rhs.parts[i].mainLoop);
+        REQUIRE( lhs.parts[i].fills.size() == rhs.parts[i].fills.size() );
+        for (std::size_t j = 0; j < lhs.parts[i].fills.size(); ++j)
+            requireSameNotes(lhs.parts[i].fills[j], rhs.parts[i].fills[j]);
+        REQUIRE( bool(lhs.parts[i].transition) == bool(rhs.parts[i].transition) );
+        if (lhs.parts[i].transition)
+            requireSameNotes(*lhs.parts[i].transition, *rhs.parts[i].transition);
+    }
+    REQUIRE( lhs.storage->size() == rhs.storage->size() );
+    REQUIRE( std::memcmp(lhs.storage->data(), rhs.storage->data(), lhs.storage->size()) == 0 );
+}
+
+}
+
+TEST_CASE("[Files] Beats that cannot be played")
+{
+    const auto file = fs::current_path() / "tests/files/virtual.json";
+    const std::string part { R"("parts": [ { "name": "A", "sequence": { "notes": [
+        { "time": 0.0, "duration": 0.5, "number": 36, "velocity": 1.0 } ] } } ] })" };
+    for (const std::string header : { R"({ "name": "A", "bpm": 0, )", R"({ "name": "A", "bpm": -90, )", R"({ "name": "A", "signature": [4, 0], )" }) {
+        const auto text = header + part;
+        std::error_code ec;
+        REQUIRE( !BeatDescription::buildFromString(file, text, ec) );
+        REQUIRE( ec == BeatDescriptionError::InvalidBeat );
+        REQUIRE( !buildDescriptionFromJson(file, nlohmann::json::parse(text), ec) );
+        REQUIRE( ec == BeatDescriptionError::InvalidBeat );
+    }
+}
+
+TEST_CASE("[Files] Streaming and document readers agree")
+{
+    std::vector<fs::path> files {
+        fs::current_path() / "tests/files/shuffle.json",
+        fs::current_path() / "tests/files/sig1.json",
+        fs::current_path() / "tests/files/sig2.json",
+        fs::current_path() / "tests/files/sig3.json",
+    };
+    for (auto& entry : fs::directory_iterator(fs::current_path() / "beats")) {
+        if (entry.path().extension() == ".json")
+            files.push_back(entry.path());
+    }
+
+    for (const auto& file : files) {
+        INFO( file );
+        const auto text = readText(file);
+        std::error_code domError;
+        auto dom = buildDescriptionFromJson(file, nlohmann::json::parse(text), domError);
+        std::error_code saxError;
+        auto sax = readBeatDescription(text.data(), text.data() + text.size(), file, saxError);
+        REQUIRE( dom );
+        REQUIRE( sax );
+        REQUIRE( !saxError );
+        requireSameDescription(*sax, *dom);
+    }
+}
+
+TEST_CASE("[Files] Streaming reader errors")
+{
+    const auto file = fs::current_path() / "tests/files/virtual.json";
+    const auto read = [&](const std::string& text, std::error_code& error) {
+        error.clear();
+        auto beat = readBeatDescription(text.data(), text.data() + text.size(), file, error);
+        std::error_code domError;
+        auto dom = buildDescriptionFromJson(file, nlohmann::json::parse(text), domError);
+        REQUIRE( bool(beat) == bool(dom) );
+        REQUIRE( error == domError );
+        if (beat)
+            requireSameDescription(*beat, *dom);
+        return beat;
+    };
+    const auto part = [](const std::string& notes) {
+        return R"({ "name": "Test", "parts": [
+            { "name": "Good", "sequence": { "notes": [ { "time": 0.0, "duration": 0.5, "number": 36, "velocity": 0.8 } ] } },
+            { "name": "Bad", "sequence": { "notes": )" + notes + R"( } } ] })";
+    };
+    std::error_code ec;
+
+    SECTION("Invalid JSON")
+    {
+        const std::string text { R"({ "name": "Test", "parts": [ )" };
+        REQUIRE( !readBeatDescription(text.data(), text.data() + text.size(), file, ec) );
+        REQUIRE( ec == BeatDescriptionError::InvalidJson );
+        REQUIRE( !BeatDescription::buildFromString(file, text, ec) );
+        REQUIRE( ec == BeatDescriptionError::InvalidJson );
+    }
+
+    SECTION("Missing name")
+    {
+        REQUIRE( !read(R"({ "parts": [ { "name": "A", "sequence": { "notes": [] } } ] })", ec) );
+        REQUIRE( ec == BeatDescriptionError::NoFilename );
+        REQUIRE( !read(R"({ "name": null, "parts": [] })", ec) );
+        REQUIRE( ec == BeatDescriptionError::NoFilename );
+    }
+
+    SECTION("No parts")
+    {
+        REQUIRE( !read(R"({ "name": "Test" })", ec) );
+        REQUIRE( ec == BeatDescriptionError::NoParts );
+        REQUIRE( !read(R"({ "name": "Test", "parts": {} })", ec) );
+        REQUIRE( ec == BeatDescriptionError::NoParts );
+        REQUIRE( !read(R"({ "name": "Test", "parts": [] })", ec) );
+        REQUIRE( ec == BeatDescriptionError::NoParts );
+        REQUIRE( !read(R"({ "name": "Test", "parts": [ { "name": "A" } ] })", ec) );
+        REQUIRE( ec == BeatDescriptionError::NoParts );
+        REQUIRE( !read(R"({ "name": "Test", "parts": [ { "name": "A", "sequence": { "notes": [] } } ] })", ec) );
+        REQUIRE( ec == BeatDescriptionError::NoParts );
+    }
+
+    SECTION("Parts with wrong notes are skipped")
+    {
+        const std::vector<std::string> wrongNotes {
+            R"({})",
+            R"([ 1 ])",
+            R"([ { "time": 1, "duration": 0.5, "number": 36, "velocity": 0.8 } ])",
+            R"([ { "time": -1.0, "duration": 0.5, "number": 36, "velocity": 0.8 } ])",
+            R"([ { "duration": 0.5, "number": 36, "velocity": 0.8 } ])",
+            R"([ { "time": 0.0, "duration": "long", "number": 36, "velocity": 0.8 } ])",
+            R"([ { "time": 0.0, "duration": 0.5, "number": 128, "velocity": 0.8 } ])",
+            R"([ { "time": 0.0, "duration": 0.5, "number": 36.0, "velocity": 0.8 } ])",
+            R"([ { "time": 0.0, "duration": 0.5, "number": 36, "velocity": 1 } ])",
+            R"([ { "time": 0.0, "duration": 0.5, "number": 36, "velocity": 0.8 }, { "time": 1.0 } ])",
+        };
+        for (const auto& notes : wrongNotes) {
+            INFO( notes );
+            auto beat = read(part(notes), ec);
+            REQUIRE( beat );
+            REQUIRE( beat->parts.size() == 1 );
+            REQUIRE( beat->parts[0].name == "Good" );
+        }
+    }
+
+    SECTION("Filenames that are not strings")
+    {
+        const std::string text { R"({ "name": "x", "parts": [ { "name": "A", "sequence": { "filename": 5 } } ] })" };
+        REQUIRE( !read(text, ec) );
+        REQUIRE( ec == BeatDescriptionError::NoParts );
+        REQUIRE( !batteur_load_beat_from_string(file.string().c_str(), text.c_str()) );
+
+        auto beat = read(R"({ "name": "Test", "parts": [
+            { "name": "Good", "sequence": { "notes": [ { "time": 0.0, "duration": 0.5, "number": 36, "velocity": 0.8 } ] },
+              "fills": [ { "filename": [ "fill.mid" ] } ] },
+            { "name": "Bad", "sequence": { "filename": null } } ] })", ec);
+        REQUIRE( beat );
+        REQUIRE( beat->parts.size() == 1 );
+        REQUIRE( beat->parts[0].fills.empty() );
+    }
+
+    SECTION("Unknown keys, unsorted notes and defaults")
+    {
+        auto beat = read(R"({ "name": "Test", "extra": { "parts": [ 1, [ 2 ] ] }, "signature": [ 6, 8 ], "parts": [
+            { "name": "A", "comment": [ { "notes": [] } ], "sequence": { "notes": [
+                { "time": 1.0, "duration": 0.5, "number": 38, "velocity": 0.8, "extra": [ 1 ] },
+                { "time": 0.0, "duration": 0.5, "number": 36, "velocity": 0.8 } ] },
+              "fills": [ null, { "notes": [] }, { "notes": [ { "time": 0.0, "duration": 0.5, "number": 42, "velocity": 0.5 } ] } ] } ] })", ec);
+        REQUIRE( beat );
+        REQUIRE( beat->bpm == 120.0f );
+        REQUIRE( beat->quartersPerBar == 3.0 );
+        REQUIRE( beat->parts[0].mainLoop.front().number == 36 );
+        REQUIRE( beat->parts[0].fills.size() == 1 );
+    }
+}
+
+TEST_CASE("[Files] Many MIDI files are read in order")
+{
+    // More references than reading threads, with some failing, in all the
+    // places a sequence can be
+    const std::vector<std::string> midiFiles {
+        "midi/shuffle_part.mid", "midi/snare_fill.mid", "midi/missing.mid", "midi/shuffle_part_ride.mid", "midi/shuffle_intro.mid"
+    };
+    std::size_t expectedParts { 0 };
+    std::string text { R"({ "name": "Many", "intro": { "filename": "midi/shuffle_intro.mid" }, "parts": [ )" };
+    for (std::size_t i = 0; i < 3 * maxReadingThreads; ++i) {
+        const auto& file = midiFiles[i % midiFiles.size()];
+        const auto& fill = midiFiles[(i + 1) % midiFiles.size()];
+        expectedParts += (file != "midi/missing.mid");
+        if (i > 0)
+            text += ", ";
+        text += R"({ "name": "Part )" + std::to_string(i) + R"(", "sequence": { "filename": ")" + file
+            + R"(" }, "fills": [ { "filename": ")" + fill + R"(" }, { "filename": ")" + file
+            + R"(", "bars": 1 } ], "transition": { "filename": ")" + fill + R"(", "ignore_bars": 1 } })";
+    }
+    text += R"( ], "ending": { "filename": "midi/snare_fill.mid" } })";
+
+    const auto file = fs::current_path() / "tests/files/virtual.json";
+    std::error_code ec;
+    auto beat = readBeatDescription(text.data(), text.data() + text.size(), file, ec);
+    REQUIRE( beat );
+    auto expected = buildDescriptionFromJson(file, nlohmann::json::parse(text), ec);
+    REQUIRE( expected );
+    requireSameDescription(*beat, *expected);
+    REQUIRE( beat->parts.size() == expectedParts );
+    REQUIRE( beat->parts[2].name == "Part 3" );
+}
+
+TEST_CASE("[Files] Identical sequences share their notes")
+{
+    std::error_code ec;
+    auto beat = BeatDescription::buildFromFile(fs::current_path() / "tests/files/shuffle.json", ec);
+    REQUIRE( beat );
+
+    // The snare fill is used twice as a fill and as the transition of the first part
+    const auto& part = beat->playback.parts[0];
+    REQUIRE( part.fills.size() == 2 );
+    REQUIRE( part.transition );
+    REQUIRE( part.fills[0].onTicks.data() == part.fills[1].onTicks.data() );
+    REQUIRE( part.fills[0].onTicks.data() == part.transition->onTicks.data() );
+    REQUIRE( part.mainLoop.onTicks.data() != part.fills[0].onTicks.data() );
+
+    // Shared notes survive a round trip through a file
+    const auto file = writeBytes("batteur_shared.btb", beat->storage->data(), beat->storage->size());
+    auto binary = BeatDescription::buildFromFile(file, ec);
+    REQUIRE( binary );
+    requireSameSequence(binary->playback.parts[0].transition.value(), *part.transition);
+    binary.reset();
+    fs::remove(file);
+}
+
+TEST_CASE("[Files] Decoded MIDI files follow changes on disk")
+{
+    const auto directory = fs::temp_directory_path() / "batteur_changing";
+    fs::create_directories(directory);
+    const auto midi = directory / "groove.mid";
+    const std::string text { R"({ "name": "Changing", "parts": [ { "name": "A", "sequence": { "filename": "groove.mid" } } ] })" };
+    const auto read = [&]() {
+        std::error_code ec;
+        auto beat = BeatDescription::buildFromString(directory / "changing.json", text, ec);
+        REQUIRE( beat );
+        return beat->parts[0].mainLoop;
+    };
+
+    fs::copy_file(fs::current_path() / "tests/files/midi/snare_fill.mid", midi, fs::copy_options::overwrite_existing);
+    const auto fill = read();
+    REQUIRE( read().size() == fill.size() );
+
+    fs::copy_file(fs::current_path() / "tests/files/midi/shuffle_part.mid", midi, fs::copy_options::overwrite_existing);
+    const auto groove = read();
+    REQUIRE( groove.size() != fill.size() );
+    fs::remove_all(directory);
+}
+
+TEST_CASE("[Files] Shared beats")
+{
+    const auto directory = fs::temp_directory_path() / "batteur_shared";
+    fs::create_directories(directory);
+    const auto file = directory / "shared.json";
+    fs::copy_file(fs::current_path() / "beats/Rock.json", file, fs::copy_options::overwrite_existing);
+
+    std::error_code ec;
+    const auto first = acquireBeat(file, ec);
+    REQUIRE( first );
+    const auto second = acquireBeat(directory / ".." / "batteur_shared" / "shared.json", ec);
+    REQUIRE( second == first );
+
+    // The first users keep the old version of a changed file
+    fs::copy_file(fs::current_path() / "beats/Pop.json", file, fs::copy_options::overwrite_existing);
+    const auto changed = acquireBeat(file, ec);
+    REQUIRE( changed );
+    REQUIRE( changed != first );
+    REQUIRE( changed->name == "Pop" );
+    REQUIRE( first->name == "Rock" );
+    releaseBeat(first);
+    REQUIRE( second->name == "Rock" );
+    releaseBeat(second);
+
+    const auto again = acquireBeat(file, ec);
+    REQUIRE( again == changed );
+    releaseBeat(again);
+    releaseBeat(changed);
+
+    REQUIRE( !acquireBeat(directory / "missing.json", ec) );
+    REQUIRE( ec == BeatDescriptionError::NonexistentFile );
+    releaseBeat(nullptr);
+    fs::remove_all(directory);
+}
+
+TEST_CASE("[Files] Beats acquired by several threads at once")
+{
+    const auto file = fs::current_path() / "beats/Pop.json";
+    std::vector<const BeatDescription*> beats (4, nullptr);
+    std::vector<std::thread> threads;
+    for (auto& beat : beats) {
+        threads.emplace_back([&beat, &file] {
+            std::error_code ec;
+            beat = acquireBeat(file, ec);
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    // The copies loaded concurrently were dropped in favor of the first one
+    REQUIRE( beats[0] );
+    for (const auto beat : beats)
+        REQUIRE( beat == beats[0] );
+
+    for (const auto beat : beats)
+        releaseBeat(beat);
+    REQUIRE( !retainBeat(beats[0]) );
+}
+
+TEST_CASE("[Files] Shared beats from their binary form")
+{
+    std::error_code ec;
+    const auto beat = BeatDescription::buildFromFile(fs::current_path() / "tests/files/shuffle.json", ec);
+    REQUIRE( beat );
+
+    // The bytes are copied, so they need not be aligned nor kept
+    std::vector<uint8_t> bytes (beat->storage->size() + 1);
+    std::memcpy(bytes.data() + 1, beat->storage->data(), beat->storage->size());
+    const auto first = acquireBeatData(bytes.data() + 1, beat->storage->size(), ec);
+    REQUIRE( first );
+    REQUIRE( !ec );
+    std::fill(bytes.begin(), bytes.end(), 0);
+    REQUIRE( first->name == beat->name );
+    REQUIRE( first->bpm == beat->bpm );
+    REQUIRE( first->playback.parts.size() == beat->playback.parts.size() );
+    for (std::size_t i = 0; i < first->playback.parts.size(); ++i)
+        requireSameSequence(first->playback.parts[i].mainLoop, beat->playback.parts[i].mainLoop);
+
+    const auto second = acquireBeatData(beat->storage->data(), beat->storage->size(), ec);
+    REQUIRE( second == first );
+    REQUIRE( retainBeat(first) );
+    releaseBeat(first);
+    releaseBeat(second);
+    releaseBeat(first);
+    REQUIRE( !retainBeat(first) );
+    REQUIRE( !retainBeat(beat.get()) );
+
+    REQUIRE( !acquireBeatData(bytes.data(), bytes.size(), ec) );
+    REQUIRE( ec == BeatDescriptionError::InvalidBinaryFile );
+    REQUIRE( !BeatDescription::buildFromBinary(beat->storage->data(), beat->storage->size() / 2, ec) );
+    REQUIRE( ec == BeatDescriptionError::InvalidBinaryFile );
+}
+
+TEST_CASE("[Files] Garbled binary beats from the state")
+{
+    std::error_code ec;
+    const auto beat = BeatDescription::buildFromFile(fs::current_path() / "tests/files/shuffle.json", ec);
+    REQUIRE( beat );
+    const std::vector<uint8_t> original { beat->storage->data(), beat->storage->data() + beat->storage->size() };
+    binary::Header header;
+    std::memcpy(&header, original.data(), sizeof(header));
+
+    auto bytes = original;
+    const auto acquire = [&bytes]() -> bool {
+        auto acquired = batteur_acquire_beat_from_data(bytes.data(), bytes.size());
+        batteur_release_beat(acquired);
+        return acquired != nullptr;
+    };
+    REQUIRE( acquire() );
+
+    const auto patch = [&bytes, &original](uint64_t offset, const void* value, std::size_t size) {
+        bytes = original;
+        std::memcpy(&bytes[offset], value, size);
+    };
+    const auto partField = header.partTable;
+    const auto sequenceField = header.sequenceTable;
+
+    for (std::size_t size = 0; size < original.size(); size += 7) {
+        bytes.assign(original.begin(), original.begin() + size);
+        REQUIRE( !acquire() );
+    }
+
+    const uint32_t huge { 0xFFFFFFF0 };
+    patch(offsetof(binary::Header, numParts), &huge, sizeof(huge));
+    REQUIRE( !acquire() );
+    patch(partField + offsetof(binary::PartEntry, numFills), &huge, sizeof(huge));
+    REQUIRE( !acquire() );
+    patch(partField + offsetof(binary::PartEntry, firstFill), &huge, sizeof(huge));
+    REQUIRE( !acquire() );
+
+    for (const int64_t duration : { int64_t { 0 }, int64_t { -1 } }) {
+        patch(sequenceField + offsetof(binary::SequenceEntry, durationTicks), &duration, sizeof(duration));
+        REQUIRE( !acquire() );
+    }
+
+    binary::SequenceEntry entry;
+    std::memcpy(&entry, &original[sequenceField], sizeof(entry));
+    REQUIRE( entry.count > 1 );
+    const int64_t late { entry.durationTicks + 1 };
+    patch(entry.notes, &late, sizeof(late));
+    REQUIRE( !acquire() );
+    const int64_t early { -1 };
+    patch(entry.notes, &early, sizeof(early));
+    REQUIRE( !acquire() );
+    int64_t onTicks[2];
+    std::memcpy(onTicks, &original[entry.notes], sizeof(onTicks));
+    if (onTicks[0] != onTicks[1]) {
+        std::swap(onTicks[0], onTicks[1]);
+        patch(entry.notes, onTicks, sizeof(onTicks));
+        REQUIRE( !acquire() );
+    }
+
+    for (const double bpm : { 0.0, -120.0, std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::infinity(), 1e300 }) {
+        patch(offsetof(binary::Header, bpm), &bpm, sizeof(bpm));
+        REQUIRE( !acquire() );
+    }
+
+    const int32_t zero { 0 };
+    patch(offsetof(binary::Header, signatureDenom), &zero, sizeof(zero));
+    REQUIRE( !acquire() );
+
+    // Anything else either reads as a beat or is rejected, without throwing
+    std::minstd_rand random { 42 };
+    for (int i = 0; i < 2000; ++i) {
+        bytes = original;
+        for (int j = 0; j < 4; ++j)
+            bytes[random() % bytes.size()] = static_cast<uint8_t>(random());
+        acquire();
+    }
+}
+
+namespace {
+
+void requireSameMetadata(const BeatInfo& info, const BeatDescription& beat)
+{
+    REQUIRE( info.name == beat.name );
+    REQUIRE( info.group == beat.group );
+    REQUIRE( info.bpm == beat.bpm );
+    REQUIRE( info.quartersPerBar == beat.quartersPerBar );
+    REQUIRE( info.signature.num == beat.signature.num );
+    REQUIRE( info.signature.denom == beat.signature.denom );
+    REQUIRE( info.parts.size() == beat.parts.size() );
+    for (std::size_t i = 0; i < info.parts.size(); ++i) {
+        REQUIRE( info.parts[i].name == beat.parts[i].name );
+        REQUIRE( info.parts[i].numFills == static_cast<int>(beat.playback.parts[i].fills.size()) );
+    }
+}
+
+}
+
+TEST_CASE("[Files] Library metadata")
+{
+    std::error_code ec;
+    for (const auto directory : { "beats", "tests/files" }) {
+        const auto root = fs::current_path() / directory;
+        auto library = BeatLibrary::scan(root, {}, ec);
+        REQUIRE( library );
+
+        // Every file that loads is listed with the same metadata, and only those
+        std::size_t numBeats { 0 };
+        for (const auto& entry : fs::recursive_directory_iterator(root)) {
+            const auto extension = entry.path().extension();
+            if (extension != ".json" && extension != ".btb")
+                continue;
+
+            std::error_code loadError;
+            const auto beat = BeatDescription::buildFromFile(entry.path(), loadError);
+            const auto file = fs::canonical(entry.path()).string();
+            const auto info = std::find_if(library->beats().begin(), library->beats().end(),
+                [&](const BeatInfo& info) { return info.file == file; });
+            if (!beat) {
+                REQUIRE( info == library->beats().end() );
+                continue;
+            }
+
+            REQUIRE( info != library->beats().end() );
+            requireSameMetadata(*info, *beat);
+            numBeats++;
+        }
+        REQUIRE( library->beats().size() == numBeats );
+    }
+}
+
+TEST_CASE("[Files] Metadata reader")
+{
+    const std::string text { R"({
+        "name": "A \"notes\": [ name",
+        "group": "notes",
+        "bpm": 96,
+        "signature": [ 6, 8 ],
+        "parts": [
+            { "name": "Empty", "sequence": { "notes": [ ] } },
+            { "name": "Main", "sequence": { "notes" : [ { "time": 0.0, "comment": "]}" } ] },
+              "fills": [ { "notes": [ 1 ] }, { "notes": [] }, { "filename": "missing.mid" } ] }
+        ]
+    })" };
+
+    BeatInfo info;
+    std::error_code ec;
+    REQUIRE( readBeatMetadata(text.data(), text.data() + text.size(), fs::current_path() / "virtual.json", info, ec) );
+    REQUIRE( info.name == "A \"notes\": [ name" );
+    REQUIRE( info.group == "notes" );
+    REQUIRE( info.bpm == 96.0f );
+    REQUIRE( info.signature.num == 6 );
+    REQUIRE( info.signature.denom == 8 );
+    REQUIRE( info.quartersPerBar == 3.0 );
+    REQUIRE( info.parts.size() == 1 );
+    REQUIRE( info.parts[0].name == "Main" );
+    REQUIRE( info.parts[0].numFills == 1 );
+
+    const std::string truncated { R"({ "name": "Cut", "parts": [ { "sequence": { "notes": [ 0, )" };
+    REQUIRE( !readBeatMetadata(truncated.data(), truncated.data() + truncated.size(), "virtual.json", info, ec) );
+    REQUIRE( ec == BeatDescriptionError::InvalidJson );
+}
+
+TEST_CASE("[Files] Library index")
+{
+    const auto directory = fs::temp_directory_path() / "batteur_library";
+    const auto index = fs::temp_directory_path() / "batteur_library.index";
+    fs::remove_all(directory);
+    fs::remove(index);
+    fs::create_directories(directory / "rock");
+    fs::copy_file(fs::current_path() / "beats/Rock.json", directory / "rock/Rock.json");
+    fs::copy_file(fs::current_path() / "beats/Pop.json", directory / "Pop.json");
+    fs::copy_file(fs::current_path() / "beats/Funk.json", directory / "Funk.json");
+    std::ofstream { (directory / "notes.json").string() } << "{ \"not\": \"a beat\" }";
+
+    std::error_code ec;
+    auto library = BeatLibrary::scan(directory, index, ec);
+    REQUIRE( library );
+    REQUIRE( library->numFilesRead() == 4 );
+    REQUIRE( library->beats().size() == 3 );
+    REQUIRE( library->beats()[0].name == "Funk" );
+    REQUIRE( library->beats()[1].name == "Pop" );
+    REQUIRE( library->beats()[2].name == "Rock" );
+    REQUIRE( fs::exists(index) );
+
+    // Unchanged files come from the index
+    auto again = BeatLibrary::scan(directory, index, ec);
+    REQUIRE( again );
+    REQUIRE( again->numFilesRead() == 0 );
+    REQUIRE( again->beats().size() == 3 );
+    for (std::size_t i = 0; i < 3; ++i) {
+        REQUIRE( again->beats()[i].file == library->beats()[i].file );
+        REQUIRE( again->beats()[i].name == library->beats()[i].name );
+        REQUIRE( again->beats()[i].bpm == library->beats()[i].bpm );
+        REQUIRE( again->beats()[i].parts.size() == library->beats()[i].parts.size() );
+    }
+
+    // Only changed files are read again
+    const auto pop = directory / "Pop.json";
+    fs::copy_file(fs::current_path() / "beats/Blues.json", pop, fs::copy_options::overwrite_existing);
+    fs::last_write_time(pop, fs::last_write_time(pop) + std::chrono::seconds(1));
+    fs::remove(directory / "Funk.json");
+    again = BeatLibrary::scan(directory, index, ec);
+    REQUIRE( again );
+    REQUIRE( again->numFilesRead() == 1 );
+    REQUIRE( again->beats().size() == 2 );
+    REQUIRE( again->beats()[0].name == "Blues" );
+    REQUIRE( again->beats()[1].name == "Rock" );
+
+    again = BeatLibrary::scan(directory, index, ec);
+    REQUIRE( again->numFilesRead() == 0 );
+
+    // A damaged index is rebuilt
+    std::ofstream { index.string(), std::ios::trunc } << "{ \"version\": ";
+    again = BeatLibrary::scan(directory, index, ec);
+    REQUIRE( again );
+    REQUIRE( again->numFilesRead() == 3 );
+    REQUIRE( again->beats().size() == 2 );
+
+    REQUIRE( !BeatLibrary::scan(directory / "missing", index, ec) );
+    REQUIRE( ec == BeatDescriptionError::NonexistentFile );
+    fs::remove_all(directory);
+    fs::remove(index);
+}
+
+TEST_CASE("[Files] Library skips truncated note lists")
+{
+    // The file ends on a page boundary inside a string of a note list, right
+    // after an escape, so that reading past it would fault
+    const auto directory = fs::temp_directory_path() / "batteur_truncated";
+    fs::remove_all(directory);
+    fs::create_directories(directory);
+    fs::copy_file(fs::current_path() / "beats/Pop.json", directory / "Pop.json");
+    std::string text { R"({ "name": "Truncated", "parts": [ { "name": "A", "sequence": { "notes": [ ")" };
+    text.resize(16384 - 1, 'x');
+    text += '\\';
+    std::ofstream { (directory / "Truncated.json").string(), std::ios::binary } << text;
+
+    std::error_code ec;
+    auto library = BeatLibrary::scan(directory, {}, ec);
+    REQUIRE( library );
+    REQUIRE( library->beats().size() == 1 );
+    REQUIRE( library->beats()[0].name == "Pop" );
+    fs::remove_all(directory);
+
+#if !defined _WIN32
+    // The page after the mapping above may be mapped as well; here it is not
+    const auto pageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    const auto pages = static_cast<char*>(mmap(nullptr, 2 * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    REQUIRE( pages != MAP_FAILED );
+    REQUIRE( mprotect(pages + pageSize, pageSize, PROT_NONE) == 0 );
+    std::memcpy(pages, text.data() + text.size() - pageSize, pageSize);
+    std::memcpy(pages, text.data(), text.find('[', text.find("notes")) + 3);
+    BeatInfo info;
+    REQUIRE( !readBeatMetadata(pages, pages + pageSize, directory / "Truncated.json", info, ec) );
+    munmap(pages, 2 * pageSize);
+#endif
+}
+
+TEST_CASE("[Files] Library queries")
+{
+    std::error_code ec;
+    auto library = BeatLibrary::scan(fs::current_path() / "beats", {}, ec);
+    REQUIRE( library );
+    const auto& beats = library->beats();
+
+    const auto bruteForce = [&](const BeatQuery& query) {
+        std::vector<std::size_t> found;
+        for (std::size_t i = 0; i < beats.size(); ++i) {
+            if ((!query.group || beats[i].group == *query.group)
+                && (!query.minBpm || beats[i].bpm >= *query.minBpm)
+                && (!query.maxBpm || beats[i].bpm <= *query.maxBpm)
+                && (!query.signature || (beats[i].signature.num == query.signature->num
+                    && beats[i].signature.denom == query.signature->denom)))
+                found.push_back(i);
+        }
+        return found;
+    };
+
+    std::vector<BeatQuery> queries(7);
+    queries[1].group = beats.front().group;
+    queries[2].group = std::string("No such group");
+    queries[3].minBpm = 80.0f;
+    queries[3].maxBpm = beats.front().bpm;
+    queries[4].maxBpm = 100.0f;
+    queries[5].signature = TimeSignature { 4, 4 };
+    queries[6].group = beats.back().group;
+    queries[6].minBpm = 60.0f;
+    queries[6].signature = beats.back().signature;
+    for (const auto& query : queries)
+        REQUIRE( library->find(query) == bruteForce(query) );
+
+    REQUIRE( library->find(queries[0]).size() == beats.size() );
+    REQUIRE( library->find(queries[2]).empty() );
+    REQUIRE( !library->find(queries[1]).empty() );
+}
+
+TEST_CASE("[Files] Setlist")
+{
+    const std::string text { R"({
+        "name": "Friday",
+        "songs": [
+            { "beat": "Rock.json", "name": "Opener", "bpm": 132 },
+            { "beat": "Pop.json" },
+            { "beat": "../beats/Rock.json", "name": "Closer" }
+        ]
+    })" };
+
+    std::error_code ec;
+    const auto setlist = Setlist::buildFromString(fs::current_path() / "beats/friday.json", text, ec);
+    REQUIRE( setlist );
+    REQUIRE( !ec );
+    REQUIRE( setlist->name() == "Friday" );
+    const auto& songs = setlist->songs();
+    REQUIRE( songs.size() == 3 );
+    REQUIRE( songs[0].name == "Opener" );
+    REQUIRE( songs[0].beat.bpm == 132.0f );
+    REQUIRE( songs[1].name == "Pop" );
+    REQUIRE( songs[2].name == "Closer" );
+
+    auto rock = BeatDescription::buildFromFile(fs::current_path() / "beats/Rock.json", ec);
+    auto pop = BeatDescription::buildFromFile(fs::current_path() / "beats/Pop.json", ec);
+    REQUIRE( rock );
+    REQUIRE( pop );
+    REQUIRE( songs[1].beat.bpm == pop->bpm );
+    REQUIRE( songs[2].beat.bpm == rock->bpm );
+    for (const auto& pair : { std::make_pair(&songs[0].beat, rock.get()), std::make_pair(&songs[1].beat, pop.get()) }) {
+        REQUIRE( pair.first->name == pair.second->name );
+        REQUIRE( pair.first->parts.size() == pair.second->parts.size() );
+        REQUIRE( pair.first->playback.parts.size() == pair.second->playback.parts.size() );
+        for (std::size_t i = 0; i < pair.first->playback.parts.size(); ++i)
+            requireSameSequence(pair.first->playback.parts[i].mainLoop, pair.second->playback.parts[i].mainLoop);
+    }
+
+    // Both beats are stored once, next to each other
+    REQUIRE( songs[0].beat.storage == songs[2].beat.storage );
+    REQUIRE( songs[0].beat.storage != songs[1].beat.storage );
+    REQUIRE( setlist->arenaSize() >= rock->storage->size() + pop->storage->size() );
+    REQUIRE( setlist->arenaSize() < rock->storage->size() + pop->storage->size() + 16 );
+    REQUIRE( songs[1].beat.storage->data() - songs[0].beat.storage->data() == static_cast<std::ptrdiff_t>((rock->storage->size() + 7) / 8 * 8) );
+
+    REQUIRE( setlist->findSong(&songs[2].beat) == 2 );
+    REQUIRE( setlist->findSong(rock.get()) == -1 );
+    REQUIRE( setlist->findSong(nullptr) == -1 );
+}
+
+TEST_CASE("[Files] Invalid setlists")
+{
+    std::error_code ec;
+    const auto virtualFile = fs::current_path() / "beats/setlist.json";
+    REQUIRE( !Setlist::buildFromString(virtualFile, "{ \"songs\": [", ec) );
+    REQUIRE( ec == BeatDescriptionError::InvalidJson );
+    REQUIRE( !Setlist::buildFromString(virtualFile, "{ \"songs\": [] }", ec) );
+    REQUIRE( ec == SetlistError::NoSongs );
+    REQUIRE( !Setlist::buildFromString(virtualFile, "{ \"songs\": [ { \"name\": \"No beat\" } ] }", ec) );
+    REQUIRE( ec == SetlistError::InvalidSong );
+    REQUIRE( !Setlist::buildFromString(virtualFile, "{ \"songs\": [ { \"beat\": \"Rock.json\", \"bpm\": 0 } ] }", ec) );
+    REQUIRE( ec == SetlistError::InvalidSong );
+    REQUIRE( !Setlist::buildFromString(virtualFile, "{ \"songs\": [ { \"beat\": \"Rock.json\" }, { \"beat\": \"Missing.json\" } ] }", ec) );
+    REQUIRE( ec == BeatDescriptionError::NonexistentFile );
+    REQUIRE( !Setlist::buildFromFile("missing_setlist.json", ec) );
+    REQUIRE( ec == BeatDescriptionError::NonexistentFile );
+}
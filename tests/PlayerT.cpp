@@ -0,0 +1,731 @@
+#include "NoteQueue.h"
+#include "Player.h"
+#include "batteur.h"
+#include "catch.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <tuple>
+using namespace Catch::literals;
+using namespace batteur;
+
+TEST_CASE("[Player] Note queue ordering")
+{
+    NoteQueue<16> queue;
+    REQUIRE( queue.pushNote(10, 20, 36, 1.0f) );
+    REQUIRE( queue.pushNote(5, 30, 38, 0.5f) );
+    REQUIRE( queue.pushNote(20, 25, 36, 0.8f) );
+    REQUIRE( queue.size() == 6 );
+
+    NoteQueue<16>::Event evt;
+    std::vector<int> delays;
+    std::vector<float> velocities;
+    while (queue.pop(32, evt)) {
+        delays.push_back(evt.delay);
+        velocities.push_back(evt.velocity);
+    }
+    REQUIRE( delays == std::vector<int> { 5, 10, 20, 20, 25, 30 } );
+    // The note-off at 20 was pushed before the note-on at 20
+    REQUIRE( velocities[2] == 0.0f );
+    REQUIRE( velocities[3] == 0.8f );
+    REQUIRE( queue.empty() );
+}
+
+TEST_CASE("[Player] Note queue across blocks")
+{
+    NoteQueue<16> queue;
+    REQUIRE( queue.pushNote(10, 100, 36, 1.0f) );
+    NoteQueue<16>::Event evt;
+    REQUIRE( queue.pop(64, evt) );
+    REQUIRE( evt.delay == 10 );
+    REQUIRE( !queue.pop(64, evt) );
+    queue.advance(64);
+    REQUIRE( queue.pop(64, evt) );
+    REQUIRE( evt.delay == 36 );
+    REQUIRE( evt.velocity == 0.0f );
+}
+
+TEST_CASE("[Player] Note queue overflow")
+{
+    NoteQueue<5> queue;
+    REQUIRE( queue.pushNote(0, 10, 36, 1.0f) );
+    REQUIRE( queue.pushNote(1, 10, 38, 1.0f) );
+    // Only one slot left: the whole note is dropped
+    REQUIRE( !queue.pushNote(2, 10, 42, 1.0f) );
+    REQUIRE( queue.size() == 4 );
+}
+
+namespace {
+
+// Note number, time in samples and velocity
+using Event = std::tuple<int, long, float>;
+
+// Plays a beat for a minute with a scripted sequence of commands, and returns
+// the note events with their absolute time in samples.
+std::vector<Event> renderBeat(const BeatDescription& beat, int blockSize)
+{
+    constexpr long sampleRate { 48000 };
+    Player player;
+    player.setSampleRate(sampleRate);
+    player.loadBeatDescription(beat);
+
+    std::vector<Event> events;
+    long time { 0 };
+    player.setNoteCallback([&](int delay, uint8_t number, float velocity) {
+        events.emplace_back(number, time + delay, velocity);
+    });
+
+    while (time < 60 * sampleRate) {
+        if (time == 0)
+            player.start();
+        else if (time / sampleRate != (time - blockSize) / sampleRate) {
+            switch (time / sampleRate) {
+            case 8: player.fillIn(); break;
+            case 20: player.next(); break;
+            case 35: player.fillIn(); break;
+            case 50: player.stop(); break;
+            default: break;
+            }
+        }
+        player.tick(blockSize);
+        time += blockSize;
+    }
+
+    std::sort(events.begin(), events.end());
+    return events;
+}
+
+// Same as renderBeat, but the commands are sent with their frame offset
+// within the block instead of at the start of the block.
+std::vector<Event> renderBeatAt(const BeatDescription& beat, int blockSize)
+{
+    constexpr long sampleRate { 48000 };
+    Player player;
+    player.setSampleRate(sampleRate);
+    player.loadBeatDescription(beat);
+
+    std::vector<Event> events;
+    long time { 0 };
+    player.setNoteCallback([&](int delay, uint8_t number, float velocity) {
+        events.emplace_back(number, time + delay, velocity);
+    });
+
+    const std::vector<std::pair<long, bool (Player::*)(int)>> commands {
+        { 1001, &Player::start },
+        { 8 * sampleRate + 5017, &Player::fillIn },
+        { 20 * sampleRate + 40013, &Player::next },
+        { 35 * sampleRate + 20011, &Player::fillIn },
+        { 50 * sampleRate + 33, &Player::stop },
+    };
+
+    while (time < 60 * sampleRate) {
+        for (const auto& command : commands) {
+            if (command.first >= time && command.first < time + blockSize)
+                (player.*command.second)(static_cast<int>(command.first - time));
+        }
+        player.tick(blockSize);
+        time += blockSize;
+    }
+
+    std::sort(events.begin(), events.end());
+    return events;
+}
+
+std::vector<Event> readEvents(const fs::path& file)
+{
+    std::vector<Event> events;
+    std::ifstream input { file.string() };
+    long time;
+    int number;
+    float velocity;
+    while (input >> time >> number >> velocity)
+        events.emplace_back(number, time, velocity);
+
+    std::sort(events.begin(), events.end());
+    return events;
+}
+
+}
+
+TEST_CASE("[Player] Same output as when rescanning sequences")
+{
+    // The reference file was rendered by a player that looked for its
+    // position from the start of the sequence on every block, and kept
+    // this position in quarters rather than in ticks. The latter can
+    // shift a note by a sample when rounding its delay.
+    std::error_code ec;
+    auto beat = BeatDescription::buildFromFile(fs::current_path() / "tests/files/shuffle.json", ec);
+    REQUIRE( beat );
+    const auto events = renderBeat(*beat, 256);
+    const auto expected = readEvents(fs::current_path() / "tests/files/shuffle_256.txt");
+    REQUIRE( events.size() == expected.size() );
+    for (std::size_t i = 0; i < events.size(); ++i) {
+        REQUIRE( std::get<0>(events[i]) == std::get<0>(expected[i]) );
+        REQUIRE( std::abs(std::get<1>(events[i]) - std::get<1>(expected[i])) <= 1 );
+        REQUIRE( std::get<2>(events[i]) == Approx(std::get<2>(expected[i])) );
+    }
+}
+
+TEST_CASE("[Player] Commands at a frame do not depend on the block size")
+{
+    std::error_code ec;
+    auto beat = BeatDescription::buildFromFile(fs::current_path() / "tests/files/shuffle.json", ec);
+    REQUIRE( beat );
+    const auto expected = renderBeatAt(*beat, 16);
+    for (int blockSize : { 64, 1000, 8192 }) {
+        const auto events = renderBeatAt(*beat, blockSize);
+        REQUIRE( events.size() == expected.size() );
+        for (std::size_t i = 0; i < events.size(); ++i) {
+            REQUIRE( std::get<0>(events[i]) == std::get<0>(expected[i]) );
+            REQUIRE( std::abs(std::get<1>(events[i]) - std::get<1>(expected[i])) <= 1 );
+        }
+    }
+}
+
+TEST_CASE("[Player] Commands carry over to the next blocks")
+{
+    std::error_code ec;
+    auto beat = BeatDescription::buildFromFile(fs::current_path() / "tests/files/shuffle.json", ec);
+    REQUIRE( beat );
+    Player player;
+    player.setSampleRate(48000);
+    player.loadBeatDescription(*beat);
+    long time { 0 };
+    long firstNote { -1 };
+    player.setNoteCallback([&](int delay, uint8_t, float velocity) {
+        if (firstNote < 0 && velocity > 0.0f)
+            firstNote = time + delay;
+    });
+    REQUIRE( player.start(300) );
+    for (; time < 1024; time += 128)
+        player.tick(128);
+    REQUIRE( player.isPlaying() );
+    REQUIRE( firstNote == 300 );
+}
+
+TEST_CASE("[Player] Sample rate changes apply at the next tick")
+{
+    std::error_code ec;
+    auto beat = BeatDescription::buildFromFile(fs::current_path() / "tests/files/shuffle.json", ec);
+    REQUIRE( beat );
+    Player player;
+    player.setSampleRate(48000);
+    player.loadBeatDescription(*beat);
+    player.setTempo(120);
+    player.setNoteCallback([](int, uint8_t, float) {});
+    player.start();
+    player.tick(24000);
+    const double position = player.getBarPosition();
+    REQUIRE( position > 0.0 );
+
+    // Half a second at each rate
+    player.setSampleRate(96000);
+    REQUIRE( player.getBarPosition() == position );
+    player.tick(48000);
+    REQUIRE( player.getBarPosition() == Approx(2 * position) );
+}
+
+TEST_CASE("[Player] Dropped notes are counted")
+{
+    // Sixteenth of a quarter apart, so that the notes are not merged
+    std::string notes;
+    for (int step = 0; step < 64; ++step) {
+        for (int number = 36; number < 44; ++number) {
+            notes += (notes.empty() ? "" : ", ");
+            notes += "{ \"time\": " + std::to_string(step / 16.0) + ", \"duration\": 0.01, \"number\": "
+                + std::to_string(number) + ", \"velocity\": 0.8 }";
+        }
+    }
+    const std::string file { R"({ "name": "Dense", "bpm": 120, "parts": [ { "name": "A", "sequence": { "notes": [ )"
+        + notes + " ] }, \"fills\": [] } ] }" };
+
+    std::error_code ec;
+    auto beat = BeatDescription::buildFromString("dense.json", file, ec);
+    REQUIRE( beat );
+    Player player;
+    player.setSampleRate(48000);
+    player.loadBeatDescription(*beat);
+    player.setNoteCallback([](int, uint8_t, float) {});
+    player.start();
+    player.tick(256);
+    REQUIRE( player.getDroppedNotes() == 0 );
+
+    // Two bars in one block do not fit in the deferred note queue
+    player.tick(192000);
+    REQUIRE( player.getDroppedNotes() > 0 );
+}
+
+TEST_CASE("[Player] No drift after hours of playback")
+{
+    // One note on each downbeat of a one bar loop, at a tempo and sample rate
+    // that do not divide each other; the k-th note must land exactly on
+    // floor(k * 4 * 60 * sampleRate / bpm) after 10 simulated hours.
+    BeatDescription beat;
+    beat.name = "Soak";
+    beat.bpm = 97.3f;
+    beat.quartersPerBar = 4;
+    beat.signature = { 4, 4 };
+    Part part;
+    part.name = "Main";
+    part.mainLoop.emplace_back(0.0, 0.5, 36, 1.0f);
+    part.mainLoop.emplace_back(3.99, 0.005, 42, 0.0f); // Pad the loop to a whole bar
+    beat.parts.push_back(std::move(part));
+    std::error_code ec;
+    REQUIRE( beat.compile(ec) );
+
+    constexpr int64_t sampleRate { 44100 };
+    constexpr int64_t bpmTimes10 { 973 };
+    Player player;
+    player.setSampleRate(sampleRate);
+    player.loadBeatDescription(beat);
+    player.setTempo(bpmTimes10 / 10.0);
+
+    int64_t time { 0 };
+    int64_t bar { 0 };
+    int64_t mismatches { 0 };
+    player.setNoteCallback([&](int delay, uint8_t number, float velocity) {
+        if (number != 36 || velocity == 0.0f)
+            return;
+
+        const int64_t expected = bar * 4 * 60 * sampleRate * 10 / bpmTimes10;
+        if (time + delay != expected)
+            mismatches++;
+        bar++;
+    });
+
+    player.start();
+    const std::array<int, 4> blockSizes { 1001, 64, 517, 4096 };
+    for (std::size_t i = 0; time < 10 * 3600 * sampleRate; ++i) {
+        const int blockSize = blockSizes[i % blockSizes.size()];
+        player.tick(blockSize);
+        time += blockSize;
+    }
+
+    REQUIRE( mismatches == 0 );
+    REQUIRE( bar == 10 * 3600 * sampleRate * bpmTimes10 / (4 * 60 * sampleRate * 10) + 1 );
+}
+
+TEST_CASE("[Player] Swap beats while playing")
+{
+    const std::string file = R"(
+        {
+            "name": "Swap",
+            "bpm" : 140,
+            "parts": [
+                {
+                    "name": "Hat",
+                    "sequence" : { "notes": [
+                        { "time": 0.0, "duration": 0.25, "number": 42, "velocity": 0.8 },
+                        { "time": 0.5, "duration": 0.25, "number": 42, "velocity": 0.8 },
+                        { "time": 1.0, "duration": 0.25, "number": 38, "velocity": 0.8 },
+                        { "time": 3.5, "duration": 0.25, "number": 42, "velocity": 0.8 }
+                    ] },
+                    "fills": []
+                }
+            ]
+        }
+    )";
+
+    Player player;
+    std::atomic<bool> running { true };
+    std::atomic<int> ticks { 0 };
+    std::error_code ec;
+    auto beat = BeatDescription::buildFromString("swap.json", file, ec);
+    REQUIRE( beat );
+    player.loadBeatDescription(*beat);
+    player.setNoteCallback([](int, uint8_t, float) {});
+
+    std::thread audioThread([&] {
+        while (running) {
+            player.start();
+            player.tick(64);
+            ticks++;
+        }
+    });
+
+    // Loading is quick enough to be done before the first tick otherwise
+    while (ticks == 0)
+        std::this_thread::yield();
+
+    for (int i = 0; i < 100; ++i) {
+        auto newBeat = BeatDescription::buildFromString("swap.json", file, ec);
+        REQUIRE( newBeat );
+        REQUIRE( player.loadBeatDescription(*newBeat) );
+        // The previous beat can be freed as soon as the new one is loaded
+        beat = std::move(newBeat);
+        if (i % 10 == 0)
+            player.allOff();
+    }
+
+    running = false;
+    audioThread.join();
+    REQUIRE( player.getBeatDescription() == beat.get() );
+    REQUIRE( ticks > 0 );
+}
+
+TEST_CASE("[Player] Load a beat while another one takes over")
+{
+    // A dense bar, so that the tick spends a while scheduling notes before
+    // it reaches the bar line and switches to the queued beat
+    std::string notes;
+    for (int step = 0; step < 96; ++step) {
+        for (int number = 36; number < 40; ++number) {
+            notes += (notes.empty() ? "" : ", ");
+            notes += "{ \"time\": " + std::to_string(step / 24.0) + ", \"duration\": 0.01, \"number\": "
+                + std::to_string(number) + ", \"velocity\": 0.8 }";
+        }
+    }
+    const std::string file { R"({ "name": "Dense", "bpm": 120, "parts": [ { "name": "A", "sequence": { "notes": [ )"
+        + notes + " ] }, \"fills\": [] } ] }" };
+
+    std::error_code ec;
+    auto loaded = BeatDescription::buildFromString("dense.json", file, ec);
+    auto queued = BeatDescription::buildFromString("dense.json", file, ec);
+    REQUIRE( loaded );
+    REQUIRE( queued );
+
+    Player player;
+    std::atomic<bool> running { true };
+    std::atomic<int> ticks { 0 };
+    player.loadBeatDescription(*loaded);
+    player.setNoteCallback([](int, uint8_t, float) {});
+
+    std::thread audioThread([&] {
+        while (running) {
+            player.start();
+            player.tick(96000); // One bar at 48 kHz
+            ticks++;
+        }
+    });
+
+    int wrongBeats { 0 };
+    for (int i = 0; i < 300; ++i) {
+        player.queueBeatDescription(*queued, Player::SwitchPoint::NextBar, Player::TempoChange::Keep);
+        // Land the load at various points of the tick that switches
+        for (volatile int spin = i % 50 * 400; spin > 0; --spin) { }
+        player.loadBeatDescription(*loaded);
+
+        // The beat that was taking over is dropped for good
+        const int target { ticks + 2 };
+        while (ticks < target)
+            std::this_thread::yield();
+        if (player.getBeatDescription() != loaded.get())
+            wrongBeats++;
+    }
+
+    running = false;
+    audioThread.join();
+    REQUIRE( wrongBeats == 0 );
+}
+
+namespace {
+
+std::string lastHalfBar(int number)
+{
+    const std::string note { "\"duration\": 0.1, \"number\": " + std::to_string(number) + ", \"velocity\": 0.8 }" };
+    return "{ \"time\": 2.0, " + note + ", { \"time\": 3.0, " + note;
+}
+
+// A beat with a note every quarter, over `bars` bars of 4/4, and a one-bar
+// fill and ending with notes on the last two quarters
+std::unique_ptr<BeatDescription> quarterBeat(const std::string& name, int number, int bpm, int bars)
+{
+    std::string notes;
+    for (int quarter = 0; quarter < 4 * bars; ++quarter) {
+        notes += (quarter > 0 ? ", " : "") + std::string("{ \"time\": ") + std::to_string(quarter)
+            + ".0, \"duration\": 0.1, \"number\": " + std::to_string(number) + ", \"velocity\": 0.8 }";
+    }
+
+    const std::string text { "{ \"name\": \"" + name + "\", \"bpm\": " + std::to_string(bpm)
+        + ", \"parts\": [ { \"name\": \"Main\", \"sequence\": { \"notes\": [ " + notes + " ] },"
+        + " \"fills\": [ { \"notes\": [ " + lastHalfBar(49) + " ] } ] } ],"
+        + " \"ending\": { \"notes\": [ " + lastHalfBar(57) + " ] } }" };
+    std::error_code ec;
+    return BeatDescription::buildFromString(name + ".json", text, ec);
+}
+
+// Note-on times in samples, by note number
+struct Onsets {
+    std::map<int, std::vector<long>> times;
+    long time { 0 };
+    void render(Player& player, long until, int blockSize = 256)
+    {
+        player.setNoteCallback([this](int delay, uint8_t number, float velocity) {
+            if (velocity > 0.0f)
+                times[number].push_back(time + delay);
+        });
+        for (; time < until; time += blockSize)
+            player.tick(blockSize);
+    }
+};
+
+constexpr long quarterAt120 { 24000 }; // At 48 kHz
+
+}
+
+TEST_CASE("[Player] Queue a beat")
+{
+    auto first = quarterBeat("First", 36, 120, 2);
+    auto second = quarterBeat("Second", 38, 120, 1);
+    REQUIRE( first );
+    REQUIRE( second );
+
+    Player player;
+    player.setSampleRate(48000);
+    player.loadBeatDescription(*first);
+    player.start();
+    Onsets onsets;
+    onsets.render(player, quarterAt120 + 1000);
+
+    SECTION("At the next bar")
+    {
+        REQUIRE( player.queueBeatDescription(*second) );
+        REQUIRE( player.getQueuedBeatDescription() == second.get() );
+        onsets.render(player, 8 * quarterAt120);
+        REQUIRE( onsets.times[36].back() == 3 * quarterAt120 );
+        REQUIRE( onsets.times[38] == std::vector<long> { 4 * quarterAt120, 5 * quarterAt120, 6 * quarterAt120, 7 * quarterAt120 } );
+        REQUIRE( player.getBeatDescription() == second.get() );
+        REQUIRE( player.getQueuedBeatDescription() == nullptr );
+        REQUIRE( player.getState() == Player::State::Playing );
+    }
+
+    SECTION("At the end of the part")
+    {
+        REQUIRE( player.queueBeatDescription(*second, Player::SwitchPoint::EndOfPart) );
+        onsets.render(player, 8 * quarterAt120);
+        REQUIRE( onsets.times[38].empty() );
+        onsets.render(player, 12 * quarterAt120);
+        REQUIRE( onsets.times[36].back() == 7 * quarterAt120 );
+        REQUIRE( onsets.times[38].front() == 8 * quarterAt120 );
+        REQUIRE( player.getBeatDescription() == second.get() );
+    }
+
+    SECTION("After a fill")
+    {
+        player.fillIn();
+        REQUIRE( player.queueBeatDescription(*second, Player::SwitchPoint::EndOfPart) );
+        onsets.render(player, 12 * quarterAt120);
+        REQUIRE( onsets.times[49] == std::vector<long> { 3 * quarterAt120 } );
+        REQUIRE( onsets.times[36].back() == 7 * quarterAt120 );
+        REQUIRE( onsets.times[38].front() == 8 * quarterAt120 );
+    }
+
+    SECTION("Cancelled")
+    {
+        REQUIRE( player.queueBeatDescription(*second) );
+        player.cancelQueuedBeat();
+        REQUIRE( player.getQueuedBeatDescription() == nullptr );
+        onsets.render(player, 12 * quarterAt120);
+        REQUIRE( onsets.times[38].empty() );
+        REQUIRE( player.getBeatDescription() == first.get() );
+    }
+
+    SECTION("While ending")
+    {
+        player.stop();
+        REQUIRE( player.queueBeatDescription(*second) );
+        onsets.render(player, 12 * quarterAt120);
+        REQUIRE( onsets.times[57] == std::vector<long> { 3 * quarterAt120 } );
+        REQUIRE( onsets.times[38].empty() );
+        REQUIRE( !player.isPlaying() );
+        REQUIRE( player.getBeatDescription() == second.get() );
+    }
+
+    REQUIRE( player.getTempo() == 120.0 );
+    for (std::size_t i = 1; i < onsets.times[38].size(); ++i)
+        REQUIRE( onsets.times[38][i] - onsets.times[38][i - 1] == quarterAt120 );
+}
+
+TEST_CASE("[Player] Queue a beat while stopped")
+{
+    auto first = quarterBeat("First", 36, 120, 1);
+    auto second = quarterBeat("Second", 38, 90, 1);
+    Player player;
+    player.setSampleRate(48000);
+    player.loadBeatDescription(*first);
+    REQUIRE( player.queueBeatDescription(*second, Player::SwitchPoint::NextBar, Player::TempoChange::Glide) );
+    Onsets onsets;
+    onsets.render(player, 256);
+    REQUIRE( player.getBeatDescription() == second.get() );
+    REQUIRE( player.getQueuedBeatDescription() == nullptr );
+    REQUIRE( !player.isPlaying() );
+    REQUIRE( player.getTempo() == 90.0 );
+}
+
+TEST_CASE("[Player] Glide to the tempo of a queued beat")
+{
+    auto first = quarterBeat("First", 36, 120, 1);
+    auto second = quarterBeat("Second", 38, 90, 1);
+    Player player;
+    player.setSampleRate(48000);
+    player.loadBeatDescription(*first);
+    player.start();
+    Onsets onsets;
+    onsets.render(player, quarterAt120 / 2);
+    REQUIRE( player.queueBeatDescription(*second, Player::SwitchPoint::NextBar, Player::TempoChange::Glide) );
+    onsets.render(player, 12 * quarterAt120);
+
+    // The quarters get longer until the switch, then stay at 90 bpm
+    const auto& before = onsets.times[36];
+    REQUIRE( before.size() == 4 );
+    for (std::size_t i = 2; i < before.size(); ++i)
+        REQUIRE( before[i] - before[i - 1] > before[i - 1] - before[i - 2] );
+
+    const auto& after = onsets.times[38];
+    REQUIRE( after.size() > 4 );
+    REQUIRE( after.front() > before.back() );
+    for (std::size_t i = 1; i < after.size(); ++i)
+        REQUIRE( after[i] - after[i - 1] == 32000 );
+    REQUIRE( player.getTempo() == 90.0 );
+
+    SECTION("A tempo change stops the glide")
+    {
+        Player other;
+        other.setSampleRate(48000);
+        other.loadBeatDescription(*first);
+        other.start();
+        Onsets otherOnsets;
+        otherOnsets.render(other, quarterAt120 / 2);
+        REQUIRE( other.queueBeatDescription(*second, Player::SwitchPoint::EndOfPart, Player::TempoChange::Glide) );
+        other.setTempo(120.0 + 1e-3);
+        otherOnsets.render(other, 12 * quarterAt120);
+        REQUIRE( other.getBeatDescription() == second.get() );
+        REQUIRE( other.getTempo() == 120.0 + 1e-3 );
+    }
+}
+
+TEST_CASE("[Player] Render into a buffer")
+{
+    std::error_code ec;
+    auto beat = BeatDescription::buildFromFile(fs::current_path() / "tests/files/shuffle.json", ec);
+    REQUIRE( beat );
+
+    Player callbackPlayer;
+    Player bufferPlayer;
+    callbackPlayer.loadBeatDescription(*beat);
+    bufferPlayer.loadBeatDescription(*beat);
+    callbackPlayer.start();
+    bufferPlayer.start();
+
+    std::vector<Event> callbackEvents;
+    std::vector<Event> bufferEvents;
+    long time { 0 };
+    callbackPlayer.setNoteCallback([&](int delay, uint8_t number, float velocity) {
+        callbackEvents.emplace_back(number, time + delay, velocity);
+    });
+
+    std::array<NoteEvent, 64> events;
+    for (int i = 0; i < 2000; ++i, time += 256) {
+        callbackPlayer.tick(256);
+        const int count = bufferPlayer.tick(256, events.data(), static_cast<int>(events.size()));
+        REQUIRE( count <= static_cast<int>(events.size()) );
+        for (int j = 0; j < count; ++j)
+            bufferEvents.emplace_back(events[j].number, time + events[j].delay, events[j].velocity);
+    }
+
+    REQUIRE( !bufferEvents.empty() );
+    REQUIRE( bufferEvents == callbackEvents );
+}
+
+TEST_CASE("[Player] Render into a small buffer")
+{
+    std::error_code ec;
+    auto beat = BeatDescription::buildFromFile(fs::current_path() / "tests/files/shuffle.json", ec);
+    REQUIRE( beat );
+
+    Player callbackPlayer;
+    Player bufferPlayer;
+    callbackPlayer.loadBeatDescription(*beat);
+    bufferPlayer.loadBeatDescription(*beat);
+    callbackPlayer.start();
+    bufferPlayer.start();
+
+    long expected { 0 };
+    callbackPlayer.setNoteCallback([&](int, uint8_t, float) { expected++; });
+
+    // Events that do not fit are returned at the start of the next blocks,
+    // so that none are lost
+    std::array<NoteEvent, 2> events;
+    long total { 0 };
+    for (int i = 0; i < 2000; ++i) {
+        callbackPlayer.tick(256);
+        const int count = bufferPlayer.tick(256, events.data(), static_cast<int>(events.size()));
+        REQUIRE( count <= 2 );
+        for (int j = 0; j < count; ++j)
+            REQUIRE( events[j].delay >= 0 );
+        total += count;
+    }
+
+    callbackPlayer.stop();
+    bufferPlayer.stop();
+    for (int i = 0; i < 2000; ++i) {
+        callbackPlayer.tick(256);
+        total += bufferPlayer.tick(256, events.data(), static_cast<int>(events.size()));
+    }
+
+    REQUIRE( expected > 0 );
+    REQUIRE( total == expected );
+}
+
+TEST_CASE("[Player] Render without room for the events")
+{
+    batteur_beat_t* beat = batteur_load_beat("tests/files/shuffle.json");
+    REQUIRE( beat );
+    batteur_player_t* bufferPlayer = batteur_new();
+    batteur_player_t* fullPlayer = batteur_new();
+    REQUIRE( batteur_load(bufferPlayer, beat) );
+    REQUIRE( batteur_load(fullPlayer, beat) );
+    batteur_start(bufferPlayer);
+    batteur_start(fullPlayer);
+
+    // The blocks are still played, so both players stay in time
+    std::array<batteur_event_t, 64> events;
+    for (int i = 0; i < 100; ++i) {
+        REQUIRE( batteur_tick_into(bufferPlayer, 256, nullptr, 64) == 0 );
+        REQUIRE( batteur_tick_into(bufferPlayer, 256, events.data(), 0) == 0 );
+        batteur_tick_into(fullPlayer, 512, events.data(), static_cast<int>(events.size()));
+    }
+    REQUIRE( batteur_get_bar_position(fullPlayer) > 0.0 );
+    REQUIRE( batteur_get_bar_position(bufferPlayer) == Approx(batteur_get_bar_position(fullPlayer)) );
+    REQUIRE( batteur_tick_into(bufferPlayer, 256, events.data(), static_cast<int>(events.size())) > 0 );
+
+    batteur_free(bufferPlayer);
+    batteur_free(fullPlayer);
+    batteur_free_beat(beat);
+}
+
+TEST_CASE("[Player] Render into a custom sink")
+{
+    std::error_code ec;
+    auto beat = BeatDescription::buildFromFile(fs::current_path() / "tests/files/shuffle.json", ec);
+    REQUIRE( beat );
+
+    Player callbackPlayer;
+    Player sinkPlayer;
+    callbackPlayer.loadBeatDescription(*beat);
+    sinkPlayer.loadBeatDescription(*beat);
+    callbackPlayer.start();
+    sinkPlayer.start();
+
+    std::vector<Event> callbackEvents;
+    std::vector<Event> sinkEvents;
+    long time { 0 };
+    callbackPlayer.setNoteCallback([&](int delay, uint8_t number, float velocity) {
+        callbackEvents.emplace_back(number, time + delay, velocity);
+    });
+
+    const auto sink = [&](int delay, uint8_t number, float velocity) {
+        sinkEvents.emplace_back(number, time + delay, velocity);
+    };
+
+    for (int i = 0; i < 2000; ++i, time += 64) {
+        callbackPlayer.tick(64);
+        sinkPlayer.tick(64, sink);
+    }
+
+    REQUIRE( !sinkEvents.empty() );
+    REQUIRE( sinkEvents == callbackEvents );
+}
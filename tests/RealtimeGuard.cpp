@@ -0,0 +1,158 @@
+#include "RealtimeGuard.h"
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <dlfcn.h>
+#include <new>
+#include <pthread.h>
+
+// Interposition relies on the glibc internal allocator entry points; this file
+// is only built when BATTEUR_TESTS_RT_GUARD is enabled.
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t count, std::size_t size);
+void* __libc_realloc(void* ptr, std::size_t size);
+void* __libc_memalign(std::size_t alignment, std::size_t size);
+void __libc_free(void* ptr);
+}
+
+namespace {
+
+thread_local bool guardActive { false };
+std::atomic<unsigned> violationCount { 0 };
+std::atomic<const char*> lastCall { nullptr };
+
+inline void check(const char* function) noexcept
+{
+    if (!guardActive)
+        return;
+
+    violationCount++;
+    lastCall.store(function);
+}
+
+template <class F>
+F nextSymbol(const char* name) noexcept
+{
+    return reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+}
+
+}
+
+namespace batteur {
+
+RealtimeGuard::RealtimeGuard() noexcept { guardActive = true; }
+RealtimeGuard::~RealtimeGuard() noexcept { guardActive = false; }
+unsigned RealtimeGuard::violations() noexcept { return violationCount.load(); }
+const char* RealtimeGuard::lastViolation() noexcept { return lastCall.load(); }
+
+void RealtimeGuard::clear() noexcept
+{
+    violationCount.store(0);
+    lastCall.store(nullptr);
+}
+
+}
+
+extern "C" {
+
+void* malloc(std::size_t size)
+{
+    check("malloc");
+    return __libc_malloc(size);
+}
+
+void* calloc(std::size_t count, std::size_t size)
+{
+    check("calloc");
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, std::size_t size)
+{
+    check("realloc");
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(std::size_t alignment, std::size_t size)
+{
+    check("memalign");
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(std::size_t alignment, std::size_t size)
+{
+    check("aligned_alloc");
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, std::size_t alignment, std::size_t size)
+{
+    check("posix_memalign");
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+
+void free(void* ptr)
+{
+    check("free");
+    __libc_free(ptr);
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+    check("pthread_mutex_lock");
+    static const auto next = nextSymbol<int (*)(pthread_mutex_t*)>("pthread_mutex_lock");
+    return next(mutex);
+}
+
+int pthread_mutex_trylock(pthread_mutex_t* mutex)
+{
+    check("pthread_mutex_trylock");
+    static const auto next = nextSymbol<int (*)(pthread_mutex_t*)>("pthread_mutex_trylock");
+    return next(mutex);
+}
+
+}
+
+void* operator new(std::size_t size)
+{
+    check("operator new");
+    if (void* ptr = __libc_malloc(size ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc {};
+}
+
+void* operator new[](std::size_t size)
+{
+    check("operator new[]");
+    if (void* ptr = __libc_malloc(size ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc {};
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    check("operator new");
+    return __libc_malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    check("operator new[]");
+    return __libc_malloc(size ? size : 1);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    check("operator delete");
+    __libc_free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    check("operator delete[]");
+    __libc_free(ptr);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+namespace batteur {
+
+/**
+ * @brief Counts the calls to the allocator and to pthread mutexes made by the
+ * current thread while a guard is alive. The test binary interposes `malloc`,
+ * `free`, `operator new` and `delete` and `pthread_mutex_lock` to do so.
+ *
+ * The hooks only count: reporting from within an allocator is not possible,
+ * so the test checks `RealtimeGuard::violations()` once the guard is gone.
+ */
+class RealtimeGuard {
+public:
+    RealtimeGuard() noexcept;
+    ~RealtimeGuard() noexcept;
+    RealtimeGuard(const RealtimeGuard&) = delete;
+    RealtimeGuard& operator=(const RealtimeGuard&) = delete;
+
+    static unsigned violations() noexcept;
+    static const char* lastViolation() noexcept;
+    static void clear() noexcept;
+};
+
+}
@@ -0,0 +1,143 @@
+#include "Player.h"
+#include "RealtimeGuard.h"
+#include "Setlist.h"
+#include "catch.hpp"
+#include <algorithm>
+#include <array>
+#include <random>
+using namespace batteur;
+
+namespace {
+
+std::vector<fs::path> shippedBeats()
+{
+    std::vector<fs::path> files;
+    for (const auto& entry : fs::directory_iterator(fs::current_path() / "beats")) {
+        if (entry.path().extension() == ".json")
+            files.push_back(entry.path());
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+}
+
+TEST_CASE("[Realtime] The guard catches allocations")
+{
+    RealtimeGuard::clear();
+    {
+        RealtimeGuard guard;
+        // Called directly, as a new expression and its delete can be optimized out
+        void* leak = ::operator new(sizeof(int));
+        ::operator delete(leak);
+    }
+    REQUIRE( RealtimeGuard::violations() == 2 );
+    RealtimeGuard::clear();
+}
+
+TEST_CASE("[Realtime] No allocations nor locks while ticking")
+{
+    const auto files = shippedBeats();
+    REQUIRE( !files.empty() );
+
+    constexpr int sampleRate { 48000 };
+    constexpr int maxEvents { 256 };
+    std::array<NoteEvent, maxEvents> events;
+    std::mt19937 rng { 42 };
+    std::uniform_int_distribution<int> blockSizes { 1, 8192 };
+    std::uniform_int_distribution<int> commands { 0, 15 };
+
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        INFO( files[i].string() );
+        std::error_code ec;
+        auto beat = BeatDescription::buildFromFile(files[i], ec);
+        REQUIRE( beat );
+        // Queued in turn with the beat, so that the player switches between them
+        auto otherBeat = BeatDescription::buildFromFile(files[(i + 1) % files.size()], ec);
+        REQUIRE( otherBeat );
+
+        Player player;
+        player.setSampleRate(sampleRate);
+        long numEvents { 0 };
+        player.setNoteCallback([&numEvents](int, uint8_t, float) { numEvents++; });
+        player.loadBeatDescription(*beat);
+        RealtimeGuard::clear();
+
+        // Two minutes of random commands at random frames and block sizes,
+        // rendered alternatively through the callback and into a buffer
+        for (long time = 0; time < 120 * sampleRate;) {
+            const int blockSize = blockSizes(rng);
+            const int frame = blockSize > 1 ? static_cast<int>(rng() % blockSize) : 0;
+            switch (commands(rng)) {
+            case 0: player.start(frame); break;
+            case 1: player.fillIn(frame); break;
+            case 2: player.next(frame); break;
+            case 3: player.stop(frame); break;
+            case 4: player.setTempo(60.0 + rng() % 120); break;
+            case 5:
+                player.queueBeatDescription(rng() % 2 ? *beat : *otherBeat,
+                    rng() % 2 ? Player::SwitchPoint::NextBar : Player::SwitchPoint::EndOfPart,
+                    rng() % 2 ? Player::TempoChange::Keep : Player::TempoChange::Glide);
+                break;
+            default: break;
+            }
+
+            {
+                RealtimeGuard guard;
+                if (time % 2 == 0)
+                    player.tick(blockSize);
+                else
+                    numEvents += player.tick(blockSize, events.data(), maxEvents);
+            }
+            time += blockSize;
+        }
+
+        INFO( "Last call: " << (RealtimeGuard::lastViolation() ? RealtimeGuard::lastViolation() : "none") );
+        REQUIRE( RealtimeGuard::violations() == 0 );
+        REQUIRE( numEvents > 0 );
+    }
+}
+
+TEST_CASE("[Realtime] Switching setlist songs")
+{
+    const auto files = shippedBeats();
+    std::string text { "{ \"songs\": [" };
+    for (std::size_t i = 0; i < files.size(); ++i)
+        text += (i > 0 ? ", { \"beat\": \"" : " { \"beat\": \"") + files[i].filename().string() + "\" }";
+    text += " ] }";
+
+    std::error_code ec;
+    const auto setlist = Setlist::buildFromString(fs::current_path() / "beats/setlist.json", text, ec);
+    REQUIRE( setlist );
+    const auto& songs = setlist->songs();
+    REQUIRE( songs.size() == files.size() );
+
+    constexpr int sampleRate { 48000 };
+    constexpr int blockSize { 256 };
+    std::mt19937 rng { 42 };
+    Player player;
+    player.setSampleRate(sampleRate);
+    long numEvents { 0 };
+    player.setNoteCallback([&numEvents](int, uint8_t, float) { numEvents++; });
+    player.loadBeatDescription(songs.front().beat);
+    player.start();
+    RealtimeGuard::clear();
+
+    // The songs are switched from the audio thread, between ticks
+    for (long time = 0; time < 120 * sampleRate; time += blockSize) {
+        RealtimeGuard guard;
+        if (time % sampleRate == 0) {
+            const auto& song = songs[rng() % songs.size()];
+            if (player.isPlaying())
+                player.queueBeatDescription(song.beat, Player::SwitchPoint::NextBar, Player::TempoChange::Glide);
+            else
+                player.loadBeatDescription(song.beat);
+        }
+        player.tick(blockSize);
+    }
+
+    INFO( "Last call: " << (RealtimeGuard::lastViolation() ? RealtimeGuard::lastViolation() : "none") );
+    REQUIRE( RealtimeGuard::violations() == 0 );
+    REQUIRE( numEvents > 0 );
+    REQUIRE( setlist->findSong(player.getBeatDescription()) >= 0 );
+}
@@ -0,0 +1,54 @@
+#include <iostream>
+#include "BeatDescription.h"
+#include "BinaryBeat.h"
+
+void usage()
+{
+    std::cerr << "Usage: " << '\n';
+    std::cerr << "\tbatteur-compile BATTEUR_DESCRIPTION_FILE OUTPUT_FILE" << '\n';
+    std::cerr << "Compiles a beat description and the MIDI files it references" << '\n';
+    std::cerr << "to a single binary file, usually with a .btb extension." << '\n';
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 3) {
+        usage();
+        return -1;
+    }
+
+    std::error_code ec;
+    auto beat = batteur::BeatDescription::buildFromFile(argv[1], ec);
+    if (ec) {
+        std::cerr << "Error reading the file " << argv[1] << " (" << ec.message() << ")\n";
+        return -1;
+    }
+
+    if (beat == nullptr || beat->storage == nullptr) {
+        std::cerr << "Unexpected error\n";
+        return -1;
+    }
+
+    // Write next to the output and rename, so that a player that has the
+    // previous version mapped in memory keeps reading consistent data.
+    const fs::path output { argv[2] };
+    fs::path temporary { output };
+    temporary += ".tmp";
+    {
+        std::ofstream stream { temporary.string(), std::ios::binary | std::ios::trunc };
+        stream.write(reinterpret_cast<const char*>(beat->storage->data()),
+            static_cast<std::streamsize>(beat->storage->size()));
+        if (!stream) {
+            std::cerr << "Error writing the file " << temporary << '\n';
+            return -1;
+        }
+    }
+
+    fs::rename(temporary, output, ec);
+    if (ec) {
+        std::cerr << "Error renaming " << temporary << " to " << output << " (" << ec.message() << ")\n";
+        return -1;
+    }
+
+    return 0;
+}